@@ -0,0 +1,447 @@
+// Generated inputs and per-stage timings for the hot paths of kcc
+
+#include "compile.h"
+#include <chrono>
+#include <thread>
+
+using namespace kcc;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double msSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // generated text is registered like a file read from disk
+    const SourceFile &addSource(const std::string &name, const std::string &text) {
+        return *SourceManager::get().add(new SourceFile(name, text));
+    }
+
+    std::vector<Token> preprocess(const SourceFile &file) {
+        Preprocessor cpp;
+        cpp.push(file);
+        std::vector<Token> tokens;
+        for (auto t = cpp.get(); t.type != Token::Type::Nil; t = cpp.get())
+            tokens.push_back(t);
+        return tokens;
+    }
+
+    // a function returning an n-term left-deep chain, a + a + ... + a
+    std::string chainSource(long n) {
+        std::string s = "int main() {\n    int a;\n    a = 1;\n    return a";
+        for (long i = 1; i < n; i++)
+            s += " + a";
+        s += ";\n}\n";
+        return s;
+    }
+
+    // deterministic, so every run and every build sees the same input
+    class Generator {
+        uint32_t seed;
+        uint32_t operatorCount; // of operators[] below that expressions use
+        std::string s;
+
+        uint32_t next(uint32_t bound) {
+            seed = seed * 1103515245u + 12345u;
+            return (seed >> 16) % bound;
+        }
+
+        void expression(int depth) {
+            static const char *const operands[] = {"a", "b", "c", "d", "1", "7", "42"};
+            // those IRGenerator has opcodes for come first
+            static const char *const operators[] = {" + ", " - ", " * ", " / ", " < ", " > ", " == ", " != ",
+                                                    " % ", " & ", " | ", " ^ ", " << ", " >> ", " && ", " || "};
+            if (depth == 0 || next(4) == 0) {
+                s += operands[next(7)];
+                return;
+            }
+            bool paren = next(3) == 0;
+            if (paren)
+                s += '(';
+            expression(depth - 1);
+            s += operators[next(operatorCount)];
+            expression(depth - 1);
+            if (paren)
+                s += ')';
+        }
+
+        void function(long i, const char *specifiers = "", const char *prefix = "f") {
+            auto name = prefix + std::to_string(i);
+            s += specifiers;
+            s += "int " + name + "(int a, int b) {\n    int c;\n    int d;\n    /* " + name + " */\n";
+            s += "    c = ", expression(4), s += ";\n";
+            s += "    d = ", expression(4), s += ";\n";
+            s += "    if (", expression(3), s += ") {\n        c = ", expression(4), s += ";\n    }\n";
+            s += "    while (c > d) {\n        c = c - 1;\n    }\n";
+            s += "    puts(\"" + name + "\");\n";
+            s += "    return ", expression(4), s += ";\n}\n\n";
+        }
+
+    public:
+        // every binary operator, or only those IRGenerator can translate
+        explicit Generator(bool translatable = false) : seed(1), operatorCount(translatable ? 8 : 16) {}
+
+        // n functions of expression-heavy code, with comments and string literals on the way
+        std::string functions(long n) {
+            s = "int puts(char *s);\n\n";
+            for (long i = 0; i < n; i++)
+                function(i);
+            return std::move(s);
+        }
+
+        // n static inline helpers as a header would bring in, and a main() that calls two of them
+        std::string helpers(long n) {
+            s = "int puts(char *s);\n\n";
+            for (long i = 0; i < n; i++)
+                function(i, "static inline ", "h");
+            s += "int main() {\n    return h0(1, 2) + h" + std::to_string(n / 2) + "(3, 4);\n}\n";
+            return std::move(s);
+        }
+
+        // statements of deep arithmetic, as macros leave it once expanded, up to the given size
+        std::string arithmetic(size_t size) {
+            s.clear();
+            while (s.size() < size) {
+                s += "x = ";
+                expression(6);
+                s += ";\n";
+            }
+            return std::move(s);
+        }
+
+        // as functions(), grown to at least the given size
+        std::string bytes(size_t size) {
+            s = "int puts(char *s);\n\n";
+            for (long i = 0; s.size() < size; i++)
+                function(i);
+            return std::move(s);
+        }
+    };
+
+    const long maxDumpedChain = 2000;
+
+    /* Every stage on one n-term chain: the tree is as deep as the chain is
+     * long, so anything recursing on depth shows up here first.
+     */
+    void chain(long n) {
+        auto &file = addSource("<chain>", chainSource(n));
+        auto start = Clock::now();
+        auto tokens = preprocess(file);
+        auto cpp = msSince(start);
+        start = Clock::now();
+        Parser parser(tokens);
+        AST *ast = parser.parse();
+        auto parse = msSince(start);
+        start = Clock::now();
+        ast->link();
+        auto link = msSince(start);
+        start = Clock::now();
+        Sema sema;
+        sema.dispatch(ast);
+        auto check = msSince(start);
+        start = Clock::now();
+        IRGenerator irGenerator;
+        irGenerator.dispatch(ast);
+        auto irgen = msSince(start);
+        start = Clock::now();
+        Arena::get().reset();
+        auto destroy = msSince(start);
+        printf("chain of %ld terms, %zu bytes: cpp %.1f ms, parse %.1f ms, link %.1f ms, sema %.1f ms, "
+               "irgen %.1f ms, free %.1f ms\n",
+               n, file.size(), cpp, parse, link, check, irgen, destroy);
+        // each line of the dump is indented by its depth, so it is only taken on short chains
+        n = std::min(n, maxDumpedChain);
+        auto shortTokens = preprocess(addSource("<chain>", chainSource(n)));
+        ast = Parser(shortTokens).parse();
+        ast->link();
+        std::string dump;
+        start = Clock::now();
+        {
+            Writer out(dump);
+            ast->dump(out);
+        }
+        auto print = msSince(start);
+        Arena::get().reset();
+        printf("dump of %ld terms: %.1f ms, %zu bytes\n", n, print, dump.size());
+    }
+
+    // the whole file in one fread, then copied into a padded SourceFile
+    SourceFile *readBulk(const char *path) {
+        FILE *f = fopen(path, "rb");
+        if (!f)
+            return nullptr;
+        std::string text;
+        char buf[1 << 16];
+        for (size_t n; (n = fread(buf, 1, sizeof(buf), f)) > 0;)
+            text.append(buf, n);
+        fclose(f);
+        return new SourceFile(path, text);
+    }
+
+    // a char at a time, as compileFile() read its input before SourceFile
+    SourceFile *readChars(const char *path) {
+        FILE *f = fopen(path, "rb");
+        if (!f)
+            return nullptr;
+        std::string text;
+        for (int c; (c = fgetc(f)) != EOF;)
+            text += (char) c;
+        fclose(f);
+        return new SourceFile(path, text);
+    }
+
+    /* Loading and lexing an n MB file written to the current directory:
+     * SourceFile::open(), which maps the file, against a bulk read and the
+     * fgetc() loop it replaced, best of five runs each.
+     */
+    void load(long n) {
+        const char *path = "kcc-bench-load.c";
+        auto text = Generator().bytes((size_t) n << 20);
+        FILE *f = fopen(path, "wb");
+        if (!f || fwrite(text.data(), 1, text.size(), f) != text.size() || fclose(f) != 0) {
+            fprintf(stderr, "cannot write '%s'\n", path);
+            return;
+        }
+        struct Loader {
+            const char *name;
+            SourceFile *(*open)(const char *path);
+        };
+        const Loader loaders[] = {{"mmap", SourceFile::open}, {"bulk read", readBulk}, {"fgetc", readChars}};
+        printf("loading and lexing %zu bytes:\n", text.size());
+        for (auto &loader : loaders) {
+            double loadMs = 0, lexMs = 0;
+            for (int run = 0; run < 5; run++) {
+                auto start = Clock::now();
+                std::unique_ptr<SourceFile> file(loader.open(path));
+                auto loaded = msSince(start);
+                if (!file) {
+                    fprintf(stderr, "cannot read '%s'\n", path);
+                    return;
+                }
+                start = Clock::now();
+                Lexer lex(*file);
+                lex.scan();
+                auto lexed = msSince(start);
+                if (run == 0 || loaded + lexed < loadMs + lexMs) {
+                    loadMs = loaded;
+                    lexMs = lexed;
+                }
+            }
+            printf("  %-9s load %.1f ms, lex %.1f ms, total %.1f ms\n", loader.name, loadMs, lexMs, loadMs + lexMs);
+        }
+        remove(path);
+    }
+
+    // Lexer::scan() over n MB of operator-dense arithmetic, best of five runs
+    void operators(long n) {
+        auto &file = addSource("<operators>", Generator().arithmetic((size_t) n << 20));
+        double fastest = 0;
+        size_t tokens = 0, punctuators = 0;
+        for (int run = 0; run < 5; run++) {
+            Lexer lex(file);
+            auto start = Clock::now();
+            lex.scan();
+            auto ms = msSince(start);
+            if (run == 0 || ms < fastest)
+                fastest = ms;
+            auto &stream = lex.getTokenStream();
+            tokens = stream.size();
+            punctuators = std::count_if(stream.begin(), stream.end(), [](const Token &t) {
+                return t.type == Token::Type::Punctuator;
+            });
+        }
+        printf("lexing %zu bytes, %zu tokens of which %zu punctuators: %.1f ms, %.1f MB/s, %.1f M tokens/s\n",
+               file.size(), tokens, punctuators, fastest, file.size() / 1048576.0 / (fastest / 1000),
+               tokens / fastest / 1000);
+    }
+
+    /* Lexer::scanParallel() on an n MB file with 1 to 16 threads, best of
+     * three runs each, against the plain scan() of one thread.
+     */
+    void threads(long n) {
+        auto &file = addSource("<threads>", Generator().bytes((size_t) n << 20));
+        auto best = [&](int threads) {
+            double fastest = 0;
+            for (int run = 0; run < 3; run++) {
+                Lexer lex(file);
+                auto start = Clock::now();
+                if (threads)
+                    lex.scanParallel(threads);
+                else
+                    lex.scan();
+                auto ms = msSince(start);
+                if (run == 0 || ms < fastest)
+                    fastest = ms;
+            }
+            return fastest;
+        };
+        auto serial = best(0);
+        printf("lexing %zu bytes, %u hardware threads: scan %.1f ms\n", file.size(),
+               std::thread::hardware_concurrency(), serial);
+        for (int threads = 1; threads <= 16; threads *= 2) {
+            auto ms = best(threads);
+            printf("  %2d threads: %.1f ms, %.0f MB/s, %.2fx\n", threads, ms,
+                   file.size() / 1048576.0 / (ms / 1000), serial / ms);
+        }
+    }
+
+    // Parser::parse() over n generated functions already preprocessed, best of five runs
+    void parse(long n) {
+        auto &file = addSource("<parse>", Generator().functions(n));
+        auto tokens = preprocess(file);
+        auto count = tokens.size();
+        double fastest = 0;
+        for (int run = 0; run < 5; run++) {
+            auto start = Clock::now();
+            Parser(tokens).parse();
+            auto ms = msSince(start);
+            Arena::get().reset();
+            if (run == 0 || ms < fastest)
+                fastest = ms;
+        }
+        printf("parsing %ld functions, %zu bytes, %zu tokens: %.1f ms, %.1f MB/s, %.1f M tokens/s\n", n,
+               file.size(), count, fastest, file.size() / 1048576.0 / (fastest / 1000), count / fastest / 1000);
+    }
+
+    /* Parsing and checking n static inline helpers of which main() calls
+     * two, with every body parsed and with bodies deferred until needed.
+     */
+    void helpers(long n) {
+        auto &file = addSource("<helpers>", Generator().helpers(std::max(n, 1L)));
+        auto tokens = preprocess(file);
+        for (int defer = 0; defer < 2; defer++) {
+            auto start = Clock::now();
+            Parser parser(tokens);
+            parser.deferBodies = defer != 0;
+            AST *ast = parser.parse();
+            auto parse = msSince(start);
+            start = Clock::now();
+            ast->link();
+            Sema sema;
+            if (defer)
+                sema.parser = &parser;
+            sema.dispatch(ast);
+            auto check = msSince(start);
+            Arena::get().reset();
+            printf("%s %ld helpers, %zu bytes: parse %.1f ms, link and sema %.1f ms\n",
+                   defer ? "deferred" : "eager", n, file.size(), parse, check);
+        }
+    }
+
+    // Sema and IRGenerator over the tree of n generated functions, best of three fresh trees
+    void check(long n) {
+        auto &file = addSource("<check>", Generator(true).functions(n));
+        auto tokens = preprocess(file);
+        double sema = 0, irgen = 0;
+        for (int run = 0; run < 3; run++) {
+            AST *ast = Parser(tokens).parse();
+            ast->link();
+            auto start = Clock::now();
+            Sema checker;
+            checker.dispatch(ast);
+            auto checked = msSince(start);
+            start = Clock::now();
+            IRGenerator irGenerator;
+            irGenerator.dispatch(ast);
+            auto generated = msSince(start);
+            if (run == 0 || checked + generated < sema + irgen) {
+                sema = checked;
+                irgen = generated;
+            }
+            Arena::get().reset();
+        }
+        printf("checking %ld functions: sema %.1f ms, irgen %.1f ms\n", n, sema, irgen);
+    }
+
+    // counts the nodes of a tree through the switch on NodeKind
+    struct StaticWalk : NodeVisitor<StaticWalk> {
+        long nodes = 0;
+
+#define KCC_BENCH_VISIT(name) \
+        void visit(name *node) { \
+            nodes++; \
+            for (auto i : *node) \
+                if (i) \
+                    dispatch(i); \
+        }
+        KCC_NODE_KINDS(KCC_BENCH_VISIT)
+#undef KCC_BENCH_VISIT
+    };
+
+    // the same through accept(), pre() and the virtual visit()
+    struct VirtualWalk : Visitor {
+        long nodes = 0;
+
+        void pre(AST *) override {}
+
+#define KCC_BENCH_VISIT(name) \
+        void visit(name *node) override { \
+            nodes++; \
+            for (auto i : *node) \
+                if (i) \
+                    i->accept(this); \
+        }
+        KCC_NODE_KINDS(KCC_BENCH_VISIT)
+#undef KCC_BENCH_VISIT
+    };
+
+    // bare traversal of the tree of n generated functions by both visitors, best of five walks each
+    void walk(long n) {
+        auto &file = addSource("<walk>", Generator().functions(n));
+        auto tokens = preprocess(file);
+        AST *ast = Parser(tokens).parse();
+        ast->link();
+        double fastest[2] = {0, 0};
+        long nodes = 0;
+        for (int run = 0; run < 5; run++) {
+            auto start = Clock::now();
+            StaticWalk s;
+            s.dispatch(ast);
+            auto ms = msSince(start);
+            if (run == 0 || ms < fastest[0])
+                fastest[0] = ms;
+            start = Clock::now();
+            VirtualWalk v;
+            ast->accept(&v);
+            ms = msSince(start);
+            if (run == 0 || ms < fastest[1])
+                fastest[1] = ms;
+            nodes = s.nodes;
+        }
+        Arena::get().reset();
+        printf("walking %ld nodes: NodeVisitor %.1f ms (%.1f ns a node), Visitor %.1f ms (%.1f ns a node)\n",
+               nodes, fastest[0], fastest[0] * 1e6 / nodes, fastest[1], fastest[1] * 1e6 / nodes);
+    }
+
+    struct Mode {
+        const char *name;
+        void (*run)(long size);
+        long size; // used when none is given
+        const char *help;
+    };
+
+    const Mode modes[] = {
+            {"chain", chain, 1000000, "every stage on one N-term a + a + ... expression"},
+            {"load", load, 8, "loading and lexing an N MB file, mapped against read"},
+            {"operators", operators, 8, "lexing N MB of operator-dense arithmetic"},
+            {"threads", threads, 32, "lexing an N MB file on 1 to 16 threads"},
+            {"parse", parse, 20000, "parsing N functions of expression-heavy code"},
+            {"inline", helpers, 20000, "N static inline helpers parsed eagerly and deferred"},
+            {"sema", check, 20000, "Sema and IR generation over N functions"},
+            {"walk", walk, 20000, "NodeVisitor against Visitor traversal of N functions"},
+    };
+}
+
+int main(int argc, char **argv) {
+    for (auto &mode : modes) {
+        if (argc > 1 && argv[1] == std::string(mode.name)) {
+            mode.run(argc > 2 ? atol(argv[2]) : mode.size);
+            return 0;
+        }
+    }
+    printf("usage: kcc-bench MODE [N]\n");
+    for (auto &mode : modes)
+        printf("  %s (N = %ld by default): %s\n", mode.name, mode.size, mode.help);
+    return 1;
+}
@@ -0,0 +1,43 @@
+#include "arena.h"
+
+using namespace kcc;
+
+void *kcc::Arena::grow(size_t size, size_t align) {
+    // large objects get a block of their own, the current block stays in use
+    if (size + align > blockSize / 4) {
+        auto block = new char[size + align];
+        large.push_back(block);
+        return (void *) (((uintptr_t) block + align - 1) & ~(uintptr_t) (align - 1));
+    }
+    ptr = new char[blockSize];
+    end = ptr + blockSize;
+    blocks.push_back(ptr);
+    return allocate(size, align);
+}
+
+void kcc::Arena::reset() {
+    for (auto iter = destructors.rbegin(); iter != destructors.rend(); iter++)
+        iter->second(iter->first);
+    destructors.clear();
+    for (auto b : large)
+        delete[] b;
+    large.clear();
+    if (blocks.empty())
+        return;
+    for (size_t i = 1; i < blocks.size(); i++)
+        delete[] blocks[i];
+    blocks.resize(1);
+    ptr = blocks[0];
+    end = ptr + blockSize;
+}
+
+kcc::Arena::~Arena() {
+    reset();
+    if (!blocks.empty())
+        delete[] blocks[0];
+}
+
+Arena &kcc::Arena::get() {
+    static Arena arena;
+    return arena;
+}
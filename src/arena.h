@@ -0,0 +1,58 @@
+// Bump allocation for AST nodes
+
+#ifndef KCC_ARENA_H
+#define KCC_ARENA_H
+
+#include "kcc.h"
+#include <type_traits>
+
+namespace kcc {
+    /* Objects of one translation unit, carved out of large blocks by moving
+     * a pointer. Nothing is freed on its own: reset() runs the destructors
+     * of everything made since the last reset and reuses the first block.
+     * Objects that are trivially destructible cost no bookkeeping at all.
+     */
+    class Arena {
+        static const size_t blockSize = 1 << 18;
+        std::vector<char *> blocks; // of blockSize, the last one is being filled
+        std::vector<char *> large; // objects that do not fit a quarter block
+        char *ptr, *end;
+        std::vector<std::pair<void *, void (*)(void *)>> destructors;
+
+        void *grow(size_t size, size_t align);
+
+        template<typename T>
+        static void destroy(void *p) { ((T *) p)->~T(); }
+
+        Arena(const Arena &) = delete;
+
+        Arena &operator=(const Arena &) = delete;
+
+    public:
+        Arena() : ptr(nullptr), end(nullptr) {}
+
+        ~Arena();
+
+        void *allocate(size_t size, size_t align) {
+            auto p = (char *) (((uintptr_t) ptr + align - 1) & ~(uintptr_t) (align - 1));
+            if (p + size > end)
+                return grow(size, align);
+            ptr = p + size;
+            return p;
+        }
+
+        template<typename T, typename... Args>
+        T *make(Args &&... args) {
+            auto p = new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            if (!std::is_trivially_destructible<T>::value)
+                destructors.emplace_back(p, &destroy<T>);
+            return p;
+        }
+
+        void reset();
+
+        // the arena of the translation unit being compiled, reset by Compiler
+        static Arena &get();
+    };
+}
+#endif //KCC_ARENA_H
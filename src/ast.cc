@@ -9,24 +9,57 @@
 #include "ast.h"
 #include "format.h"
 #include "visitor.h"
+#include "arena.h"
+
+const char *kcc::nodeKindName(NodeKind k) {
+    static const char *names[] = {
+            "",
+#define KCC_NODE_KIND_NAME(name) #name,
+            KCC_NODE_KINDS(KCC_NODE_KIND_NAME)
+#undef KCC_NODE_KIND_NAME
+    };
+    return names[(int) k];
+}
 
-kcc::AST::AST() {
+kcc::AST::AST(NodeKind k) : children(nullptr), count(0), capacity(0), pos(Token::noOffset), parent(nullptr),
+                             record(nullptr), scale(0), nodeKind(k) {
     isFloat = false;
     isGlobal = false;
 }
 
+/* With an explicit stack, expression trees can be as deep as they are
+ * long. Children are pushed last first so nodes are reached in the order
+ * the parser allocated them.
+ */
 void kcc::AST::linkRec() {
-    for (auto i : children) {
-        i->parent = this;
-        i->linkRec();
+    std::vector<AST *> stack{this};
+    while (!stack.empty()) {
+        auto node = stack.back();
+        stack.pop_back();
+        for (auto i = node->count; i-- > 0;) {
+            auto child = node->children[i];
+            if (child) {
+                child->parent = node;
+                if (child->count) // leaves have nothing to link
+                    stack.push_back(child);
+            }
+        }
     }
 }
 
-kcc::AST::~AST() {
-    for (auto i:children) {
-        delete i;
-    }
-    children.clear();
+// the old array stays in the Arena until it is reset
+void kcc::AST::grow() {
+    capacity = capacity ? capacity * 2 : 2;
+    auto a = (AST **) Arena::get().allocate(capacity * sizeof(AST *), alignof(AST *));
+    if (count)
+        memcpy(a, children, count * sizeof(AST *));
+    children = a;
+}
+
+kcc::Record &kcc::AST::mutableRecord() {
+    if (!record)
+        record = Arena::get().make<Record>();
+    return *record;
 }
 
 void kcc::AST::link() {
@@ -34,31 +67,51 @@ void kcc::AST::link() {
     linkRec();
 }
 
-std::string kcc::AST::info() const {
-    return format("{}[{}]\n", kind(), content.tok);
+void kcc::AST::info(Writer &out) const {
+    out.print("{}[{}]\n", kindName(), content.str());
 }
 
 void kcc::AST::accept(kcc::Visitor *) {}
 
-std::string kcc::AST::str(int depth) const {
-    std::string s = "";
-    for (int i = 0; i < depth; i++)
-        s.append("  ");
-    s.append(info());
-    for (auto i : children) {
-        if (i) {
-            s.append(i->str(depth + 1));
+// preorder with an explicit stack, children pushed last first
+void kcc::AST::dump(Writer &out, int depth) const {
+    std::vector<std::pair<const AST *, int>> stack{{this, depth}};
+    while (!stack.empty()) {
+        auto node = stack.back().first;
+        auto d = stack.back().second;
+        stack.pop_back();
+        out.indent(d);
+        node->info(out);
+        for (auto i = node->count; i-- > 0;) {
+            if (node->children[i]) {
+                stack.emplace_back(node->children[i], d + 1);
+            }
         }
     }
+}
+
+std::string kcc::AST::str(int depth) const {
+    std::string s;
+    {
+        Writer out(s);
+        dump(out, depth);
+    }
     return s;
 }
 
-std::string kcc::ArrayType::info() const {
-    return format("{}[{}]\n", kind(), arrSize);
+void kcc::Literal::info(Writer &out) const {
+    out.print("{}[{}]\n", kindName(), escapeString(content.str()));
+}
+
+void kcc::ArrayType::info(Writer &out) const {
+    out.print("{}[{}]\n", kindName(), arrSize);
 }
 
+// for debuggers, the text stays valid until the next call
 const char *printstr(kcc::AST *ast) {
-    return ast->str().c_str();
+    static std::string s;
+    s = ast->str();
+    return s.c_str();
 }
 
 #define AST_ACCEPT(classname) void kcc::classname::accept(kcc::Visitor*vis){vis->pre(this);vis->visit(this);}
@@ -120,14 +173,19 @@ AST_ACCEPT(PostfixExpr)
 
 AST_ACCEPT(FuncArgType)
 
+void kcc::FuncDef::setBody(AST *block) {
+    add(block);
+    linkRec();
+}
+
 kcc::FuncType *kcc::FuncDef::extractCallSignature() {
-    auto f = new FuncType();
+    auto f = Arena::get().make<FuncType>();
     f->add(first());
-    f->add(dynamic_cast<FuncDefArg*>(third())->extractArgType());
+    f->add(dyn_cast<FuncDefArg>(third())->extractArgType());
     return f;
 }
 kcc::FuncArgType *kcc::FuncDefArg::extractArgType() {
-    auto arg = new FuncArgType();
+    auto arg = Arena::get().make<FuncArgType>();
     for(auto i:*this){
         arg->add(i->first());
     }
@@ -11,26 +11,12 @@
 #include "kcc.h"
 #include "lex.h"
 #include "format.h"
+#include "writer.h"
+#include <cstring>
 
 namespace kcc {
-    struct Token;
-
     class Visitor;
 
-    struct SourcePos {
-        int line;
-        int col;
-        const char *filename;
-
-        SourcePos() = default;
-
-        SourcePos(const char *_filename, int a, int b) {
-            line = a;
-            col = b;
-            filename = _filename;
-        }
-    };
-
     class Type;
 
     struct Value {
@@ -44,7 +30,7 @@ namespace kcc {
         } type;
         int offset;
         double fImm;
-        int iImm;
+        long long iImm;
 
         Value() {
             type = Type::None;
@@ -57,6 +43,11 @@ namespace kcc {
             iImm = i;
         }
 
+        explicit Value(long long i) {
+            type = static_cast<Type>(Type::Imm | Type::Int);
+            iImm = i;
+        }
+
         explicit Value(double i) {
             type = static_cast<Type>(Type::Imm | Type::Float);
             fImm = i;
@@ -71,7 +62,7 @@ namespace kcc {
             assert(isRegister());
             return offset;
         }
-        int getImm()const{
+        long long getImm()const{
             assert(isImm());
             return iImm;
         }
@@ -116,105 +107,169 @@ namespace kcc {
         }
     };
 
+#define KCC_NODE_KINDS(X) \
+        X(BinaryExpression) \
+        X(PostfixExpr) \
+        X(UnaryExpression) \
+        X(TernaryExpression) \
+        X(Identifier) \
+        X(Number) \
+        X(Literal) \
+        X(CastExpression) \
+        X(IndexExpression) \
+        X(CallExpression) \
+        X(ArgumentExepressionList) \
+        X(PrimitiveType) \
+        X(PointerType) \
+        X(ArrayType) \
+        X(FuncType) \
+        X(FuncArgType) \
+        X(While) \
+        X(If) \
+        X(Block) \
+        X(TopLevel) \
+        X(DeclarationList) \
+        X(Declaration) \
+        X(FuncDefArg) \
+        X(FuncDef) \
+        X(Return) \
+        X(For) \
+        X(Empty) \
+        X(Enum)
+
+    // the class of an AST node, stored in the node, see isa() and dyn_cast()
+    enum class NodeKind : unsigned char {
+        None,
+#define KCC_NODE_KIND_ENUM(name) name,
+        KCC_NODE_KINDS(KCC_NODE_KIND_ENUM)
+#undef KCC_NODE_KIND_ENUM
+    };
+
+    const char *nodeKindName(NodeKind k);
+
+    /* A node is 64 bytes and owns nothing: the children array and the
+     * Record Sema fills in are allocated from the Arena when first needed,
+     * so nodes are trivially destructible and cost the Arena no cleanup.
+     */
     class AST {
     protected:
-        std::vector<AST *> children;
+        AST **children; // in the Arena, capacity entries
+        uint32_t count, capacity;
         Token content;
+    public:
+        uint32_t pos; // global source offset, see SourceManager
+    protected:
         AST *parent;
-        Record record;
+        Record *record; // nullptr until a field is set
 
         virtual void linkRec();
 
+        void grow();
+
+        Record &mutableRecord();
+
+    public:
+        unsigned int scale;
+    protected:
+        NodeKind nodeKind;
     public:
         bool isFloat;
         bool isGlobal;
-        unsigned int scale;
 
         void setType(Type *ty) {
-            record.type = ty;
+            mutableRecord().type = ty;
         }
 
         void setAddr(const Value &a) {
-            record.addr = a;
+            mutableRecord().addr = a;
         }
 
-        Value getAddr() const { return record.addr; }
+        Value getAddr() const { return record ? record->addr : Value(); }
 
-        Value getReg() const { return record.reg; }
+        Value getReg() const { return record ? record->reg : Value(); }
 
-        void setReg(const Value &r) { record.reg = r; }
+        void setReg(const Value &r) { mutableRecord().reg = r; }
 
         Type *getType() const {
-            return record.type;
+            return record ? record->type : nullptr;
         }
 
-        SourcePos pos;
-
-        AST();
+        explicit AST(NodeKind k = NodeKind::None);
 
         void setContent(const Token &t) {
             content = t;
         }
 
+        // the subtree, one node per line indented by depth
+        void dump(Writer &out, int depth = 0) const;
+
         virtual std::string str(int depth = 0) const;
 
-        virtual std::string info() const;
+        // the line of this node in dump()
+        virtual void info(Writer &out) const;
 
-        virtual const std::string kind() const { return std::string(); };
+        NodeKind kind() const { return nodeKind; }
+
+        const char *kindName() const { return nodeKindName(nodeKind); }
 
         inline AST *first() const {
-            return children.at(0);
+            return get(0);
         }
 
         inline AST *second() const {
-            return children.at(1);
+            return get(1);
         }
 
         inline AST *third() const {
-            return children.at(2);
+            return get(2);
         }
 
         inline AST *forth() const {
-            return children.at(3);
+            return get(3);
         }
 
         inline void add(AST *t) {
-            children.push_back(t);
+            if (count == capacity)
+                grow();
+            children[count++] = t;
         }
 
         inline int size() const {
-            return children.size();
+            return (int) count;
         }
 
         inline const Token &getToken() const {
             return content;
         }
 
-        inline std::vector<AST *>::reverse_iterator rbegin() {
-            return children.rbegin();
+        inline std::reverse_iterator<AST **> rbegin() {
+            return std::reverse_iterator<AST **>(end());
         }
 
-        inline std::vector<AST *>::reverse_iterator rend() {
-            return children.rend();
+        inline std::reverse_iterator<AST **> rend() {
+            return std::reverse_iterator<AST **>(begin());
         }
 
-        inline std::vector<AST *>::iterator begin() {
-            return children.begin();
+        inline AST **begin() const {
+            return children;
         }
 
-        inline std::vector<AST *>::iterator end() {
-            return children.end();
+        inline AST **end() const {
+            return children + count;
         }
 
         void set(int i, AST *ast) {
+            assert(i >= 0 && (uint32_t) i < count);
             children[i] = ast;
         }
 
-        AST *get(int i) {
-            return children.at(i);
+        AST *get(int i) const {
+            assert(i >= 0 && (uint32_t) i < count);
+            return children[i];
         }
 
-        virtual ~AST();
+        // not virtual, nodes are never deleted through an AST *, see Arena
+        ~AST() = default;
 
         virtual void accept(Visitor *vis);
 
@@ -222,25 +277,37 @@ namespace kcc {
 
         AST *getParent() const { return parent; }
 
-        const std::string &tok() const { return getToken().tok; }
+        const std::string &tok() const { return getToken().str(); }
 
         std::string getPos() const {
-            return format("{}:{}:{}", pos.filename, pos.line, pos.col);
+            auto p = SourceManager::get().getPos(pos);
+            return format("{}:{}:{}", p.filename, p.line, p.col);
         }
     };
 
     const char *printstr(AST *ast);
 
+    // ast is a T, T is one of the classes in KCC_NODE_KINDS
+    template<typename T>
+    inline bool isa(const AST *ast) {
+        return ast && ast->kind() == T::classKind;
+    }
+
+    template<typename T>
+    inline T *dyn_cast(AST *ast) {
+        return isa<T>(ast) ? static_cast<T *>(ast) : nullptr;
+    }
+
     class BinaryExpression : public AST {
     public:
-        explicit BinaryExpression(const Token &t) {
+        explicit BinaryExpression(const Token &t) : AST(NodeKind::BinaryExpression) {
             content = t;
             scale = 1;
         }
 
-        BinaryExpression() { scale = 1; }
+        BinaryExpression() : AST(NodeKind::BinaryExpression) { scale = 1; }
 
-        const std::string kind() const override { return "BinaryExpression"; }
+        static const NodeKind classKind = NodeKind::BinaryExpression;
 
         void accept(Visitor *) override;
 
@@ -251,22 +318,22 @@ namespace kcc {
 
     class PostfixExpr : public AST {
     public:
-        explicit PostfixExpr(const Token &t) { content = t; }
+        explicit PostfixExpr(const Token &t) : AST(NodeKind::PostfixExpr) { content = t; }
 
-        PostfixExpr() = default;
+        PostfixExpr() : AST(NodeKind::PostfixExpr) {}
 
-        const std::string kind() const override { return "PostfixExpr"; }
+        static const NodeKind classKind = NodeKind::PostfixExpr;
 
         void accept(Visitor *) override;
     };
 
     class UnaryExpression : public AST {
     public:
-        explicit UnaryExpression(const Token &t) { content = t; }
+        explicit UnaryExpression(const Token &t) : AST(NodeKind::UnaryExpression) { content = t; }
 
-        UnaryExpression() = default;
+        UnaryExpression() : AST(NodeKind::UnaryExpression) {}
 
-        const std::string kind() const override { return "UnaryExpression"; }
+        static const NodeKind classKind = NodeKind::UnaryExpression;
 
         void accept(Visitor *) override;
 
@@ -275,70 +342,83 @@ namespace kcc {
 
     class TernaryExpression : public AST {
     public:
-        TernaryExpression() = default;
+        TernaryExpression() : AST(NodeKind::TernaryExpression) {}
 
-        const std::string kind() const override { return "TernaryExpression"; }
+        static const NodeKind classKind = NodeKind::TernaryExpression;
 
         void accept(Visitor *) override;
     };
 
     class Identifier : public AST {
     public:
-        Identifier() = default;
+        Identifier() : AST(NodeKind::Identifier) {}
 
-        explicit Identifier(const Token &t) { content = t; }
+        explicit Identifier(const Token &t) : AST(NodeKind::Identifier) { content = t; }
 
-        const std::string kind() const override { return "Identifier"; }
+        static const NodeKind classKind = NodeKind::Identifier;
 
         void accept(Visitor *) override;
     };
 
     class Number : public AST {
+        uint64_t bits; // long long or double, decided by the token type
     public:
-        Number() {}
+        Number() : AST(NodeKind::Number), bits(0) {}
 
-        explicit Number(const Token &t) { content = t; }
+        // the value was converted by the lexer, see Interner::value
+        explicit Number(const Token &t) : AST(NodeKind::Number), bits(Interner::get().value(t.sym)) { content = t; }
 
-        const std::string kind() const override { return "Number"; }
+        static const NodeKind classKind = NodeKind::Number;
 
         void accept(Visitor *) override;
 
-        int getInt() {
-            std::istringstream in(tok());
-            int i;
-            in >> i;
-            return i;
+        bool isFloatLiteral() const { return content.type == Token::Type::Float; }
+
+        long long getInt() const {
+            return isFloatLiteral() ? (long long) getDouble() : (long long) bits;
         }
 
-        double getFloat() {
-            std::istringstream in(tok());
-            double i;
-            in >> i;
-            return i;
+        double getFloat() const {
+            return isFloatLiteral() ? getDouble() : (double) (long long) bits;
+        }
+
+        void setInt(long long i) { bits = (uint64_t) i; }
+
+        void setFloat(double f) { memcpy(&bits, &f, sizeof(bits)); }
+
+    private:
+        double getDouble() const {
+            double f;
+            memcpy(&f, &bits, sizeof(f));
+            return f;
         }
     };
 
     class Literal : public AST {
     public:
-        explicit Literal(const Token &t) { content = t; }
+        explicit Literal(const Token &t) : AST(NodeKind::Literal) { content = t; }
 
-        const std::string kind() const override { return "Literal"; }
+        static const NodeKind classKind = NodeKind::Literal;
+
+        void info(Writer &out) const override;
 
         void accept(Visitor *) override;
     };
 
     class CastExpression : public AST {
     public:
-        CastExpression() = default;
+        CastExpression() : AST(NodeKind::CastExpression) {}
 
-        const std::string kind() const override { return "CastExpression"; }
+        static const NodeKind classKind = NodeKind::CastExpression;
 
         void accept(Visitor *) override;
     };
 
     class IndexExpression : public AST {
     public:
-        const std::string kind() const override { return "IndexExpression"; }
+        static const NodeKind classKind = NodeKind::IndexExpression;
+
+        IndexExpression() : AST(NodeKind::IndexExpression) {}
 
         void accept(Visitor *) override;
     };
@@ -347,7 +427,9 @@ namespace kcc {
 
     class CallExpression : public AST {
     public:
-        const std::string kind() const override { return "CallExpression"; }
+        static const NodeKind classKind = NodeKind::CallExpression;
+
+        CallExpression() : AST(NodeKind::CallExpression) {}
 
         void accept(Visitor *) override;
 
@@ -358,45 +440,45 @@ namespace kcc {
 
     class ArgumentExepressionList : public AST {
     public:
-        const std::string kind() const override { return "ArgumentExepressionList"; }
+        static const NodeKind classKind = NodeKind::ArgumentExepressionList;
+
+        ArgumentExepressionList() : AST(NodeKind::ArgumentExepressionList) {}
 
         void accept(Visitor *) override;
     };
 
     class Type : public AST {
     public:
-        virtual bool isPrimitive() const { return false; }
+        explicit Type(NodeKind k) : AST(k) {}
+
+        bool isPrimitive() const { return kind() == NodeKind::PrimitiveType; }
 
-        virtual bool isArray() const { return false; }
+        bool isArray() const { return kind() == NodeKind::ArrayType; }
 
-        virtual bool isPointer() const { return false; }
+        bool isPointer() const { return kind() == NodeKind::PointerType; }
 
         virtual std::string repr() const { return std::string(); }
     };
 
     class PrimitiveType : public Type {
     public:
-        explicit PrimitiveType(const Token &t) { content = t; }
+        explicit PrimitiveType(const Token &t) : Type(NodeKind::PrimitiveType) { content = t; }
 
-        const std::string kind() const override { return "PrimitiveType"; }
+        static const NodeKind classKind = NodeKind::PrimitiveType;
 
         void accept(Visitor *) override;
 
-        bool isPrimitive() const override { return true; }
-
         std::string repr() const { return tok(); }
     };
 
     class PointerType : public Type {
     public:
-        explicit PointerType() {}
+        explicit PointerType() : Type(NodeKind::PointerType) {}
 
-        const std::string kind() const override { return "PointerType"; }
+        static const NodeKind classKind = NodeKind::PointerType;
 
         void accept(Visitor *) override;
 
-        bool isPointer() const override { return true; }
-
         Type *ptrTo() const { return (Type *) first(); }
 
         std::string repr() const { return ((Type *) first())->repr().append("*"); }
@@ -405,13 +487,15 @@ namespace kcc {
     class ArrayType : public Type {
         int arrSize;
     public:
-        explicit ArrayType(int size = -1) {
+        explicit ArrayType(int size = -1) : Type(NodeKind::ArrayType) {
             arrSize = size;
         }
 
-        const std::string kind() const override { return "ArrayType"; }
+        static const NodeKind classKind = NodeKind::ArrayType;
+
+        int arraySize() const { return arrSize; }
 
-        std::string info() const override;
+        void info(Writer &out) const override;
 
         void accept(Visitor *) override;
     };
@@ -420,9 +504,9 @@ namespace kcc {
 
     class FuncType : public Type {
     public:
-        explicit FuncType() {}
+        explicit FuncType() : Type(NodeKind::FuncType) {}
 
-        const std::string kind() const override { return "FuncType"; }
+        static const NodeKind classKind = NodeKind::FuncType;
 
         void accept(Visitor *) override;
 
@@ -433,9 +517,9 @@ namespace kcc {
 
     class FuncArgType : public Type {
     public:
-        explicit FuncArgType() {}
+        explicit FuncArgType() : Type(NodeKind::FuncArgType) {}
 
-        const std::string kind() const override { return "FuncArgType"; }
+        static const NodeKind classKind = NodeKind::FuncArgType;
 
         void accept(Visitor *) override;
 
@@ -444,7 +528,9 @@ namespace kcc {
 
     class While : public AST {
     public:
-        const std::string kind() const override { return "While"; }
+        static const NodeKind classKind = NodeKind::While;
+
+        While() : AST(NodeKind::While) {}
 
         void accept(Visitor *) override;
 
@@ -455,7 +541,9 @@ namespace kcc {
 
     class If : public AST {
     public:
-        const std::string kind() const override { return "If"; }
+        static const NodeKind classKind = NodeKind::If;
+
+        If() : AST(NodeKind::If) {}
 
         void accept(Visitor *) override;
 
@@ -468,28 +556,36 @@ namespace kcc {
 
     class Block : public AST {
     public:
-        const std::string kind() const override { return "Block"; }
+        static const NodeKind classKind = NodeKind::Block;
+
+        Block() : AST(NodeKind::Block) {}
 
         void accept(Visitor *) override;
     };
 
     class TopLevel : public AST {
     public:
-        const std::string kind() const override { return "TopLevel"; }
+        static const NodeKind classKind = NodeKind::TopLevel;
+
+        TopLevel() : AST(NodeKind::TopLevel) {}
 
         void accept(Visitor *) override;
     };
 
     class DeclarationList : public AST {
     public:
-        const std::string kind() const override { return "DeclarationList"; }
+        static const NodeKind classKind = NodeKind::DeclarationList;
+
+        DeclarationList() : AST(NodeKind::DeclarationList) {}
 
         void accept(Visitor *) override;
     };
 
     class Declaration : public AST {
     public:
-        const std::string kind() const override { return "Declaration"; }
+        static const NodeKind classKind = NodeKind::Declaration;
+
+        Declaration() : AST(NodeKind::Declaration) {}
 
         void accept(Visitor *) override;
 
@@ -502,7 +598,9 @@ namespace kcc {
     class FuncDefArg : public AST {
     public:
 
-        const std::string kind() const override { return "FuncDefArg"; }
+        static const NodeKind classKind = NodeKind::FuncDefArg;
+
+        FuncDefArg() : AST(NodeKind::FuncDefArg) {}
 
         void accept(Visitor *) override;
 
@@ -512,8 +610,19 @@ namespace kcc {
     class FuncDef : public AST {
     public:
         unsigned int frameSize;
+        bool internal; // static or inline, no definition has to be emitted
+        // '{' to '}' of a body not parsed yet and Nil tokens, in the Arena, see Parser::deferBodies
+        const Token *deferredBody;
+
+        FuncDef() : AST(NodeKind::FuncDef), frameSize(0), internal(false), deferredBody(nullptr) {}
 
-        const std::string kind() const override { return "FuncDef"; }
+        static const NodeKind classKind = NodeKind::FuncDef;
+
+        // the body is still in deferredBody, block() is missing
+        bool deferred() const { return size() < 4; }
+
+        // adds the body of a deferred function and links it in
+        void setBody(AST *block);
 
         void accept(Visitor *) override;
 
@@ -532,14 +641,18 @@ namespace kcc {
 
     class Return : public AST {
     public:
-        const std::string kind() const override { return "Return"; }
+        static const NodeKind classKind = NodeKind::Return;
+
+        Return() : AST(NodeKind::Return) {}
 
         void accept(Visitor *) override;
     };
 
     class For : public AST {
     public:
-        const std::string kind() const override { return "For"; }
+        static const NodeKind classKind = NodeKind::For;
+
+        For() : AST(NodeKind::For) {}
 
         void accept(Visitor *) override;
 
@@ -554,14 +667,18 @@ namespace kcc {
 
     class Empty : public AST {
     public:
-        const std::string kind() const override { return "Empty"; }
+        static const NodeKind classKind = NodeKind::Empty;
+
+        Empty() : AST(NodeKind::Empty) {}
 
         void accept(Visitor *) override;
     };
 
     class Enum : public AST {
     public:
-        const std::string kind() const override { return "Enum"; }
+        static const NodeKind classKind = NodeKind::Enum;
+
+        Enum() : AST(NodeKind::Enum) {}
 
         void accept(Visitor *) override;
     };
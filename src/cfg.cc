@@ -7,69 +7,80 @@
 
 using namespace kcc;
 
-void CFG::dump() {
-    std::ofstream out("flow.md");
-    out << "```flow\nst=>start: Start\ne=>end: End\n";
+// a flowchart.js diagram in a markdown code block
+void CFG::dump(Writer &out) {
+    out.write("```flow\nst=>start: Start\ne=>end: End\n");
     auto getId = [](BasicBlock *i) { return i->id; };
     for (auto i:allBlocks) {
         auto id = getId(i);
-        std::string s;
-        s.append(format("id={}\n", id));
+        if (i->branchFalse.empty())
+            out.print("n{}=>operation: ", id);
+        else
+            out.print("n{}=>condition: ", id);
+        out.print("id={}\n", id);
         if (!i->phi.empty()) {
             for(const auto& phi:i->phi) {
-                s.append(phi.dump()).append("\n");
+                phi.dump(out);
+                out.put('\n');
             }
         }
         for (const auto &stmt:i->block) {
-            s.append(stmt.dump()).append("\n");
+            stmt.dump(out);
+            out.put('\n');
         }
         if(i->idom()){
-            s.append(format("idom={}\n", getId(i->idom())));
+            out.print("idom={}\n", getId(i->idom()));
         }
         if (!i->dom.empty()) {
-            s.append("dom=");
+            out.write("dom=");
             for (const auto f : i->dom) {
-                s.append(format("{} ", getId(f)));
+                out.print("{} ", getId(f));
             }
-            s.append("\n");
+            out.put('\n');
         }
         if (!i->DF.empty()) {
-            s.append("DF=");
+            out.write("DF=");
             for (const auto f : i->DF) {
-                s.append(format("{} ", getId(f)));
+                out.print("{} ", getId(f));
             }
-            s.append("\n");
+            out.put('\n');
         }
         if (!i->children.empty()) {
-            s.append("child=");
+            out.write("child=");
             for (const auto f : i->children) {
-                s.append(format("{} ", getId(f)));
+                out.print("{} ", getId(f));
             }
-            s.append("\n");
+            out.put('\n');
         }
-        if (i->branchFalse.empty())
-            out << format("n{}=>operation: {}\n", id, s);
-        else
-            out << format("n{}=>condition: {}\n", id, s);
-
+        out.put('\n');
     }
-    out << format("st->n{}\n", allBlocks[0]->id);
+    out.print("st->n{}\n", allBlocks[0]->id);
     for (auto i:allBlocks) {
         auto id = getId(i);
         for (auto e:i->in) {
-            out << format("n{}->n{}\n", getId(e.from), getId(e.to));
+            out.print("n{}->n{}\n", getId(e.from), getId(e.to));
         }
         if (!i->branchFalse.empty()) {
-            out << format("n{}(yes)->n{}\n", id, getId(i->branchTrue.to));
-            out << format("n{}(no)->n{}\n", id, getId(i->branchFalse.to));
+            out.print("n{}(yes)->n{}\n", id, getId(i->branchTrue.to));
+            out.print("n{}(no)->n{}\n", id, getId(i->branchFalse.to));
         } else {
             if (!i->branchTrue.empty()) {
-                out << format("n{}->n{}\n", id, getId(i->branchTrue.to));
+                out.print("n{}->n{}\n", id, getId(i->branchTrue.to));
             }
         }
     }
-    out << "```" << std::endl;
-    out.close();
+    out.write("```\n");
+}
+
+void CFG::dump() {
+    auto f = fopen("flow.md", "w");
+    if (!f)
+        return;
+    {
+        Writer out(f);
+        dump(out);
+    }
+    fclose(f);
 }
 
 template<typename T>
@@ -66,6 +66,9 @@ namespace kcc {
             }
         }
 
+        void dump(Writer &out);
+
+        // writes dump() to flow.md
         void dump();
 
         void computeDominator();
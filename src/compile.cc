@@ -5,27 +5,116 @@
 #include "compile.h"
 using namespace kcc;
 
-void kcc::Compiler::compileFile(const char *filename) {
-    std::string src;
-    FILE *f = fopen(filename, "r");
-    if (!f) {
+bool kcc::Compiler::compileFile(const char *filename) {
+    // the tree of this translation unit is freed at once, after everything else
+    struct ArenaReset {
+        ~ArenaReset() { Arena::get().reset(); }
+    } arenaReset;
+    auto src = SourceFile::open(filename);
+    if (!src) {
         fprintln(stderr, "{} does not exist", filename);
+        return false;
     }
-    while (!feof(f)) {
-        char c = (char) fgetc(f);
-        if (c != EOF && c)
-            src += c;
+    Writer out(stdout); // everything this file prints
+    Preprocessor cpp;
+    cpp.includePaths = includePaths;
+    for (auto &d : defines) {
+        cpp.define(d.first, d.second);
+    }
+    std::unique_ptr<DependencyWriter> deps;
+    if (writeDependencies) {
+        std::string base = filename;
+        auto slash = base.find_last_of('/');
+        auto dot = base.find_last_of('.');
+        if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+            base.erase(dot);
+        auto path = dependencyFile.empty() ? base + ".d" : dependencyFile;
+        auto target = dependencyTarget;
+        if (target.empty())
+            target = (slash == std::string::npos ? base : base.substr(slash + 1)) + ".o";
+        deps.reset(DependencyWriter::open(path, target, filename));
+        if (!deps)
+            fprintln(stderr, "cannot write '{}'", path);
+        cpp.dependencies = deps.get();
     }
-    Lexer lex(filename, src);
-    lex.scan();
-    Parser p(lex);
-    auto ast = p.parse();
-    ast->link();
-    //   println("{}", ast->str());
     Sema sema;
-    ast->accept(&sema);
+    if (!includePCH.empty()) {
+        try {
+            PCH::read(includePCH, cpp, sema);
+        } catch (std::runtime_error &e) {
+            fprintln(stderr, "{}: error: {}", includePCH, e.what());
+            return false;
+        }
+    }
+    cpp.push(*SourceManager::get().add(src), lexThreads);
+    if (preprocessOnly) {
+        cpp.joinStrings = false; // string literals are joined after preprocessing
+        std::string last;
+        for (auto t = cpp.get(); t.type != Token::Type::Nil; t = cpp.get()) {
+            auto s = Preprocessor::spell(t);
+            // tokens out of macros may sit next to each other without a space
+            bool glued = false;
+            if (!last.empty() && (isalnum(last.back()) || last.back() == '_')) {
+                glued = isalnum(s[0]) || s[0] == '_';
+            } else if (!last.empty() && t.type == Token::Type::Punctuator) {
+                int len;
+                glued = matchPunctuator((last + s).c_str(), len) != Punct::None && len > (int) last.size();
+            }
+            if (t.flags & Token::StartOfLine)
+                out.put('\n');
+            else if ((t.flags & Token::LeadingSpace) || glued)
+                out.put(' ');
+            out.write(s);
+            last = s;
+        }
+        out.put('\n');
+        return cpp.errors == 0;
+    }
+    // the parser stays around for the bodies Sema asks for
+    std::unique_ptr<Parser> p;
+    std::vector<Token> tokens;
+    if (streamTokens) {
+        p.reset(new Parser(cpp));
+    } else {
+        for (auto t = cpp.get(); t.type != Token::Type::Nil; t = cpp.get()) {
+            tokens.push_back(t);
+        }
+        p.reset(new Parser(tokens));
+    }
+    p->deferBodies = deferBodies;
+    AST *ast = p->parse();
+    if (deferBodies)
+        sema.parser = p.get();
+    ast->link();
+    sema.dispatch(ast);
+    bool ok = cpp.errors == 0 && p->errors == 0 && sema.errors == 0;
+    if (dumpAST) {
+        ast->dump(out);
+        return ok;
+    }
+    if (!emitPCH.empty()) {
+        try {
+            for (auto i : *ast) {
+                if (isa<FuncDef>(i))
+                    throw std::runtime_error(format("{}: function definitions cannot be precompiled",
+                                                    i->getPos()));
+            }
+            PCH::write(emitPCH, cpp, sema);
+        } catch (std::runtime_error &e) {
+            fprintln(stderr, "{}: error: {}", emitPCH, e.what());
+            return false;
+        }
+        return ok;
+    }
     IRGenerator irGenerator;
-    ast->accept(&irGenerator);
-    irGenerator.printIR();
+    irGenerator.dispatch(ast);
+    ok = ok && irGenerator.errors == 0;
+    if (dumpIR) {
+        irGenerator.dumpIR(out);
+        return ok;
+    }
+    irGenerator.printIR(out);
+    out.flush(); // printed even if a later stage fails
     irGenerator.buildSSA();
+    return ok;
 }
@@ -6,13 +6,33 @@
 #define KCC_COMPILE_H
 
 #include "lex.h"
+#include "cpp.h"
 #include "parse.h"
 #include "sema.h"
 #include "ir-gen.h"
+#include "pch.h"
 namespace  kcc{
     class Compiler{
     public:
-        void compileFile(const char * filename);
+        bool streamTokens; // false lexes the whole file before parsing
+        int lexThreads; // more than 1 lexes the whole file in parallel before parsing
+        bool preprocessOnly; // -E, prints the preprocessed tokens instead of compiling
+        std::vector<std::string> includePaths; // -I
+        std::vector<std::pair<std::string, std::string>> defines; // -D
+        std::string emitPCH; // -emit-pch, the input is a header to precompile into this file
+        std::string includePCH; // -include-pch, loaded before the input is read
+        bool writeDependencies; // -MD
+        std::string dependencyFile; // -MF, the input with a .d extension by default
+        std::string dependencyTarget; // -MT, the input with a .o extension by default
+        bool deferBodies; // -defer-bodies, static and inline functions are parsed once referenced
+        bool dumpAST; // -dump-ast, prints the tree after Sema instead of generating code
+        bool dumpIR; // -dump-ir, prints the IR of every function instead of building SSA
+
+        Compiler() : streamTokens(true), lexThreads(1), preprocessOnly(false), writeDependencies(false),
+                     deferBodies(false), dumpAST(false), dumpIR(false) {}
+
+        // returns false if an error was reported
+        bool compileFile(const char * filename);
     };
 }
 #endif //KCC_COMPILE_H
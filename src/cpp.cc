@@ -2,3 +2,1295 @@
 // Created by xiaoc on 2018/8/9.
 //
 
+#include "cpp.h"
+#include "format.h"
+#include <climits>
+#include <sys/types.h> // stat() is in the Windows CRT too, under these names
+#include <sys/stat.h>
+
+using namespace kcc;
+
+kcc::HideSets::HideSets() {
+    make({});
+}
+
+uint32_t kcc::HideSets::make(const std::vector<Symbol> &set) {
+    auto iter = ids.find(set);
+    if (iter != ids.end())
+        return iter->second;
+    auto id = (uint32_t) sets.size();
+    sets.push_back(set);
+    ids.insert(std::make_pair(set, id));
+    return id;
+}
+
+uint32_t kcc::HideSets::add(uint32_t set, Symbol sym) {
+    auto key = (uint64_t) set << 32 | sym;
+    auto iter = additions.find(key);
+    if (iter != additions.end())
+        return iter->second;
+    auto s = sets[set];
+    auto at = std::lower_bound(s.begin(), s.end(), sym);
+    if (at == s.end() || *at != sym)
+        s.insert(at, sym);
+    auto id = make(s);
+    additions[key] = id;
+    return id;
+}
+
+uint32_t kcc::HideSets::unite(uint32_t a, uint32_t b) {
+    if (a == b || b == 0)
+        return a;
+    if (a == 0)
+        return b;
+    auto key = (uint64_t) std::min(a, b) << 32 | std::max(a, b);
+    auto iter = unions.find(key);
+    if (iter != unions.end())
+        return iter->second;
+    std::vector<Symbol> s;
+    std::set_union(sets[a].begin(), sets[a].end(), sets[b].begin(), sets[b].end(), std::back_inserter(s));
+    auto id = make(s);
+    unions[key] = id;
+    return id;
+}
+
+uint32_t kcc::HideSets::intersect(uint32_t a, uint32_t b) {
+    if (a == b || b == 0)
+        return b;
+    if (a == 0)
+        return a;
+    auto key = (uint64_t) std::min(a, b) << 32 | std::max(a, b);
+    auto iter = intersections.find(key);
+    if (iter != intersections.end())
+        return iter->second;
+    std::vector<Symbol> s;
+    std::set_intersection(sets[a].begin(), sets[a].end(), sets[b].begin(), sets[b].end(), std::back_inserter(s));
+    auto id = make(s);
+    intersections[key] = id;
+    return id;
+}
+
+// in nanoseconds where the platform keeps them, whole seconds elsewhere
+static uint64_t modified(const struct stat &st) {
+#if defined(__linux__)
+    return (uint64_t) st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+    return (uint64_t) st.st_mtimespec.tv_sec * 1000000000ull + st.st_mtimespec.tv_nsec;
+#else
+    return (uint64_t) st.st_mtime * 1000000000ull;
+#endif
+}
+
+kcc::HeaderCache::Header *kcc::HeaderCache::open(const std::string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG)
+        return nullptr;
+    Key key{(uint64_t) st.st_dev, (uint64_t) st.st_ino, (uint64_t) st.st_size, modified(st)};
+    auto iter = byKey.find(key);
+    if (iter != byKey.end())
+        return iter->second;
+    auto file = SourceFile::open(path.c_str());
+    if (!file)
+        return nullptr;
+    std::unique_ptr<Header> h(new Header());
+    h->id = (uint32_t) headers.size();
+    h->file = SourceManager::get().add(file);
+    byKey[key] = h.get();
+    headers.push_back(std::move(h));
+    return headers.back().get();
+}
+
+kcc::HeaderCache &kcc::HeaderCache::get() {
+    static HeaderCache cache;
+    return cache;
+}
+
+kcc::DependencyWriter *kcc::DependencyWriter::open(const std::string &path, const std::string &target,
+                                                  const std::string &source) {
+    auto f = fopen(path.c_str(), "w");
+    if (!f)
+        return nullptr;
+    auto w = new DependencyWriter(f);
+    w->append(target);
+    w->buffer += ": ";
+    w->append(source);
+    return w;
+}
+
+// make needs spaces, '#' and '$' in file names escaped
+void kcc::DependencyWriter::append(const std::string &path) {
+    for (auto c : path) {
+        if (c == ' ' || c == '#')
+            buffer += '\\';
+        else if (c == '$')
+            buffer += '$';
+        buffer += c;
+    }
+}
+
+void kcc::DependencyWriter::add(const std::string &path) {
+    buffer += " \\\n  ";
+    append(path);
+    if (buffer.size() >= 1u << 16)
+        flush();
+}
+
+void kcc::DependencyWriter::flush() {
+    fwrite(buffer.data(), 1, buffer.size(), out);
+    buffer.clear();
+}
+
+kcc::DependencyWriter::~DependencyWriter() {
+    buffer += '\n';
+    flush();
+    fclose(out);
+}
+
+static Token intToken(long long v, uint32_t offset) {
+    auto &strings = Interner::get();
+    Token t(Token::Type::Int, strings.intern(format("{}", v)), offset);
+    strings.setValue(t.sym, (uint64_t) v);
+    return t;
+}
+
+static bool isName(const Token &t) {
+    return t.type == Token::Type::Identifier || t.type == Token::Type::Keyword;
+}
+
+kcc::Preprocessor::Preprocessor()
+        : floor(0), bounded(false), memoSeen(4096), memoDepth(0), memoBuiltin(false), where(Token::noOffset),
+          dependencies(nullptr), errors(0), joinStrings(true) {
+    auto &strings = Interner::get();
+    sInclude = strings.intern("include");
+    sIncludeNext = strings.intern("include_next");
+    sDefine = strings.intern("define");
+    sUndef = strings.intern("undef");
+    sIf = strings.intern("if");
+    sIfdef = strings.intern("ifdef");
+    sIfndef = strings.intern("ifndef");
+    sElif = strings.intern("elif");
+    sElse = strings.intern("else");
+    sEndif = strings.intern("endif");
+    sPragma = strings.intern("pragma");
+    sError = strings.intern("error");
+    sWarning = strings.intern("warning");
+    sLine = strings.intern("line");
+    sDefined = strings.intern("defined");
+    sOnce = strings.intern("once");
+    sVaArgs = strings.intern("__VA_ARGS__");
+    defineBuiltin("__FILE__", FileMacro);
+    defineBuiltin("__LINE__", LineMacro);
+    define("__STDC__", "1");
+    define("__STDC_HOSTED__", "1");
+    define("__STDC_VERSION__", "199901L");
+    define("__kcc__", "1");
+    define("__x86_64__", "1"); // the target of x64-gen
+    define("__LP64__", "1");
+}
+
+void kcc::Preprocessor::defineBuiltin(const char *name, int builtin) {
+    auto sym = Interner::get().intern(name);
+    if (macros.size() <= sym)
+        macros.resize(sym + 1);
+    macros[sym].reset(new Macro());
+    macros[sym]->builtin = builtin;
+}
+
+void kcc::Preprocessor::error(uint32_t offset, const std::string &message) {
+    auto pos = SourceManager::get().getPos(offset);
+    fprintln(stderr, "{}:{}:{}:error: {}", pos.filename, pos.line, pos.col, message);
+    errors++;
+}
+
+void kcc::Preprocessor::warning(uint32_t offset, const std::string &message) {
+    auto pos = SourceManager::get().getPos(offset);
+    fprintln(stderr, "{}:{}:{}:warning: {}", pos.filename, pos.line, pos.col, message);
+}
+
+void kcc::Preprocessor::define(const std::string &name, const std::string &value) {
+    predefines += format("#define {} {}\n", name, value);
+}
+
+void kcc::Preprocessor::push(const SourceFile &file, int lexThreads) {
+    enter(file, lexThreads);
+    if (!predefines.empty()) {
+        enter(*SourceManager::get().add(new SourceFile("<command line>", predefines)), 1);
+        predefines.clear();
+    }
+}
+
+void kcc::Preprocessor::enter(const SourceFile &file, int lexThreads) {
+    File f;
+    f.tokens = nullptr;
+    if (lexThreads > 1) {
+        Lexer lex(file, true);
+        lex.scanParallel(lexThreads);
+        f.scanned.reset(new std::vector<Token>());
+        f.scanned->swap(lex.getTokenStream());
+        f.tokens = f.scanned.get();
+    } else {
+        f.lexer.reset(new Lexer(file, true));
+    }
+    f.next = 0;
+    f.header = nullptr;
+    f.recording = nullptr;
+    f.file = &file;
+    f.conds = conds.size();
+    f.dir = -1;
+    f.guard = Guard::None;
+    f.guardMacro = 0;
+    files.push_back(std::move(f));
+}
+
+void kcc::Preprocessor::enter(HeaderCache::Header *header, int dir) {
+    if (files.size() >= 200)
+        throw std::runtime_error("#include nested too deeply");
+    File f;
+    f.tokens = nullptr;
+    f.recording = nullptr;
+    if (header->lexed) {
+        f.tokens = &header->tokens;
+    } else {
+        f.lexer.reset(new Lexer(*header->file, true));
+        if (!header->recording) {
+            header->recording = true;
+            f.recording = header;
+        }
+    }
+    f.next = 0;
+    f.header = header;
+    f.file = header->file;
+    f.conds = conds.size();
+    f.dir = dir;
+    f.guard = header->guard ? Guard::None : Guard::Start;
+    f.guardMacro = 0;
+    files.push_back(std::move(f));
+    if (entered.size() <= header->id)
+        entered.resize(header->id + 1);
+    entered[header->id] = true;
+}
+
+std::string kcc::Preprocessor::spell(const Token &t) {
+    if (t.type == Token::Type::String)
+        return format("\"{}\"", escapeString(t.str()));
+    return t.str();
+}
+
+// next token of the current file, Nil at its end
+Token kcc::Preprocessor::lexRaw() {
+    auto &f = files.back();
+    if (!f.unread.empty()) {
+        auto t = f.unread.back();
+        f.unread.pop_back();
+        return t;
+    }
+    while (true) {
+        if (f.lexer) {
+            auto t = f.lexer->get();
+            if (t.type != Token::Type::Nil) {
+                if (f.recording)
+                    f.recording->tokens.push_back(t);
+                return t;
+            }
+            f.lexer.reset();
+        }
+        if (!f.tokens || f.next == f.tokens->size())
+            return Token();
+        auto &t = (*f.tokens)[f.next++];
+        if (t.type != Token::Type::Skipped)
+            return t;
+        // skipped when the header was first read, but included now
+        f.lexer.reset(new Lexer(*f.file, t.offset, t.offset + t.sym, true));
+    }
+}
+
+// the rest of a directive line
+std::vector<Token> kcc::Preprocessor::readLine() {
+    std::vector<Token> line;
+    while (true) {
+        auto t = lexRaw();
+        if (t.type == Token::Type::Nil)
+            break;
+        if (t.flags & Token::StartOfLine) {
+            files.back().unread.push_back(t);
+            break;
+        }
+        line.push_back(t);
+    }
+    return line;
+}
+
+void kcc::Preprocessor::unget(const PPToken &t) {
+    if (t.tok.type != Token::Type::Nil)
+        expanded.push_back(t);
+}
+
+// next token before expansion, directives are run on the way
+PPToken kcc::Preprocessor::read() {
+    while (true) {
+        if (expanded.size() > floor) {
+            auto t = expanded.back();
+            expanded.pop_back();
+            return t;
+        }
+        if (bounded)
+            return PPToken();
+        auto t = lexRaw();
+        if (t.type == Token::Type::Nil) {
+            if (conds.size() > files.back().conds) {
+                where = conds.back().offset;
+                conds.resize(files.back().conds);
+                throw std::runtime_error("unterminated conditional directive");
+            }
+            if (files.size() == 1)
+                return PPToken();
+            auto &f = files.back();
+            if (f.guard == Guard::Closed)
+                f.header->guard = f.guardMacro;
+            if (f.recording) {
+                f.recording->lexed = true;
+                f.recording->recording = false;
+            }
+            files.pop_back();
+            continue;
+        }
+        where = t.offset;
+        if (t.punct() == Punct::Hash && (t.flags & Token::StartOfLine)) {
+            directive(t);
+            continue;
+        }
+        if (files.back().guard != Guard::Open)
+            files.back().guard = Guard::None;
+        return t;
+    }
+}
+
+// next token after macro expansion
+PPToken kcc::Preprocessor::expand() {
+    while (true) {
+        auto t = read();
+        auto m = find(t.tok);
+        if (memoDepth && isName(t.tok)) {
+            if (memoDeps.size() <= t.tok.sym)
+                memoDeps.resize(t.tok.sym + 1);
+            memoDeps[t.tok.sym] = true;
+        }
+        if (!m || hidesets.contains(t.hideset, t.tok.sym))
+            return t;
+        if (m->builtin) {
+            memoBuiltin = true;
+            auto pos = SourceManager::get().getPos(t.tok.offset);
+            Token r = m->builtin == FileMacro
+                      ? Token(Token::Type::String, Interner::get().intern(pos.filename), t.tok.offset)
+                      : intToken(pos.line, t.tok.offset);
+            r.flags = t.tok.flags;
+            return PPToken(r, t.hideset);
+        }
+        std::vector<std::vector<PPToken>> args;
+        if (!m->function) {
+            substitute(*m, args, hidesets.add(t.hideset, t.tok.sym), t.tok);
+            continue;
+        }
+        auto lparen = read();
+        if (lparen.tok.punct() != Punct::LParen) {
+            unget(lparen);
+            return t;
+        }
+        // an invocation in error is reported and dropped, leaving its name as gcc does
+        PPToken rparen;
+        int depth = 0;
+        args.emplace_back();
+        while (true) {
+            auto a = read();
+            auto p = a.tok.punct();
+            if (a.tok.type == Token::Type::Nil) {
+                error(t.tok.offset, format("unterminated argument list invoking macro '{}'", t.tok.str()));
+                return t;
+            }
+            if (p == Punct::RParen && depth == 0) {
+                rparen = a;
+                break;
+            }
+            if (p == Punct::LParen)
+                depth++;
+            else if (p == Punct::RParen)
+                depth--;
+            else if (p == Punct::Comma && depth == 0 && !(m->variadic && (int) args.size() == m->params)) {
+                args.emplace_back();
+                continue;
+            }
+            args.back().push_back(a);
+        }
+        if (m->params == 0 && args.size() == 1 && args[0].empty())
+            args.clear();
+        if (m->variadic && (int) args.size() == m->params - 1)
+            args.emplace_back();
+        if ((int) args.size() != m->params) {
+            error(t.tok.offset, format("macro '{}' takes {} arguments, {} given",
+                                       t.tok.str(), m->params, (int) args.size()));
+            return t;
+        }
+        auto hs = hidesets.add(hidesets.intersect(t.hideset, rparen.hideset), t.tok.sym);
+        substitute(*m, args, hs, t.tok);
+    }
+}
+
+// fully expands a list of tokens on its own, for macro arguments and #if
+std::vector<PPToken> kcc::Preprocessor::expandList(const std::vector<PPToken> &list) {
+    auto savedFloor = floor;
+    auto savedBounded = bounded;
+    floor = expanded.size();
+    bounded = true;
+    for (auto iter = list.rbegin(); iter != list.rend(); iter++)
+        expanded.push_back(*iter);
+    std::vector<PPToken> out;
+    try {
+        for (auto t = expand(); t.tok.type != Token::Type::Nil; t = expand())
+            out.push_back(t);
+    } catch (std::runtime_error &) {
+        // what is left of the list goes with the error
+        expanded.resize(floor);
+        floor = savedFloor;
+        bounded = savedBounded;
+        throw;
+    }
+    floor = savedFloor;
+    bounded = savedBounded;
+    return out;
+}
+
+/* Replaces a macro invocation by its body, C99 6.10.3.
+ * The result is pushed onto the expanded stack, so it is rescanned.
+ * Results are memoized, only their offsets and first flags differ between
+ * invocations.
+ */
+void kcc::Preprocessor::substitute(const Macro &m, std::vector<std::vector<PPToken>> &args, uint32_t hideset,
+                                   const Token &name) {
+    memoKey.assign({name.sym, hideset});
+    for (auto &arg : args) {
+        for (auto &t : arg) {
+            memoKey.push_back((uint32_t) t.tok.type | (uint32_t) t.tok.flags << 8);
+            memoKey.push_back(t.tok.sym);
+            memoKey.push_back(t.hideset);
+        }
+        memoKey.push_back(~0u); // no token has this type
+    }
+    auto iter = memo.find(memoKey);
+    std::vector<PPToken> fresh;
+    const std::vector<PPToken> *r;
+    if (iter != memo.end()) {
+        r = &iter->second;
+    } else {
+        auto h = MemoKeyHash()(memoKey);
+        auto &seen = memoSeen[h & (memoSeen.size() - 1)];
+        bool keep = seen == h;
+        seen = h;
+        std::vector<uint32_t> key;
+        if (keep)
+            key = memoKey; // nested substitutions reuse memoKey
+        auto outerBuiltin = memoBuiltin;
+        memoBuiltin = false;
+        memoDepth++;
+        try {
+            fresh = replace(m, args, hideset, name);
+        } catch (std::runtime_error &) {
+            memoDepth--;
+            memoBuiltin = outerBuiltin;
+            throw;
+        }
+        memoDepth--;
+        r = &fresh;
+        if (keep && !memoBuiltin) {
+            if (memo.size() >= 1u << 16)
+                memo.clear();
+            if (memoDeps.size() <= name.sym)
+                memoDeps.resize(name.sym + 1);
+            memoDeps[name.sym] = true;
+            r = &memo.emplace(std::move(key), std::move(fresh)).first->second;
+        }
+        memoBuiltin = outerBuiltin || memoBuiltin;
+    }
+    // expanded tokens are never directives, the first one takes the place of the name
+    for (size_t i = r->size(); i-- > 0;) {
+        expanded.push_back((*r)[i]);
+        expanded.back().tok.offset = name.offset;
+    }
+    if (!r->empty())
+        expanded.back().tok.flags = name.flags;
+}
+
+// the body of m with the arguments substituted, before rescanning
+std::vector<PPToken> kcc::Preprocessor::replace(const Macro &m, std::vector<std::vector<PPToken>> &args,
+                                                uint32_t hideset, const Token &name) {
+    std::vector<PPToken> r;
+    std::vector<std::vector<PPToken>> expandedArgs(args.size());
+    std::vector<bool> done(args.size(), false);
+    bool placemarker = false; // the last operand of ## was empty
+    auto &body = m.body;
+    auto n = body.size();
+    for (size_t i = 0; i < n; i++) {
+        auto &b = body[i];
+        if (m.function && b.punct() == Punct::Hash && i + 1 < n && m.param[i + 1] >= 0) {
+            r.emplace_back(stringify(args[m.param[i + 1]], name.offset));
+            placemarker = false;
+            i++;
+            continue;
+        }
+        if (b.punct() == Punct::HashHash && i + 1 < n) {
+            int q = m.param[i + 1];
+            std::vector<PPToken> rhs;
+            if (q >= 0)
+                rhs = args[q];
+            else
+                rhs.emplace_back(body[i + 1]);
+            if (q >= 0 && m.variadic && q == m.params - 1 && !placemarker
+                && !r.empty() && r.back().tok.punct() == Punct::Comma) {
+                // , ## __VA_ARGS__ drops the comma when there are no variadic arguments
+                if (rhs.empty())
+                    r.pop_back();
+                else
+                    r.insert(r.end(), rhs.begin(), rhs.end());
+            } else if (!rhs.empty()) {
+                auto first = rhs.begin();
+                if (!placemarker && !r.empty()) {
+                    r.back().tok = paste(r.back().tok, first->tok);
+                    first++;
+                }
+                r.insert(r.end(), first, rhs.end());
+            }
+            placemarker = placemarker && rhs.empty();
+            i++;
+            continue;
+        }
+        int p = m.param[i];
+        if (p >= 0) {
+            auto &arg = args[p];
+            if (i + 1 < n && body[i + 1].punct() == Punct::HashHash) {
+                // operands of ## are not expanded
+                r.insert(r.end(), arg.begin(), arg.end());
+                placemarker = arg.empty();
+            } else {
+                if (!done[p]) {
+                    expandedArgs[p] = expandList(arg);
+                    done[p] = true;
+                }
+                r.insert(r.end(), expandedArgs[p].begin(), expandedArgs[p].end());
+                placemarker = false;
+            }
+            continue;
+        }
+        r.emplace_back(b);
+        placemarker = false;
+    }
+    for (size_t i = 0; i < r.size(); i++) {
+        r[i].hideset = hidesets.unite(r[i].hideset, hideset);
+        r[i].tok.flags &= ~Token::StartOfLine;
+    }
+    return r;
+}
+
+// a macro is defined or undefined, memoized substitutions that looked it up are stale
+void kcc::Preprocessor::changed(Symbol macro) {
+    if (macro < memoDeps.size() && memoDeps[macro]) {
+        memo.clear();
+        memoDeps.clear();
+    }
+}
+
+std::string kcc::Preprocessor::spelling(const Token &t) {
+    auto file = SourceManager::get().find(t.offset);
+    if (file && t.offset < file->offset() + file->size()) {
+        Lexer lex(*file, t.offset, file->offset() + (uint32_t) file->size(), true);
+        auto again = lex.get();
+        // a pasted token or __LINE__ sits where something else is written
+        if (again.type == t.type && again.sym == t.sym) {
+            std::string s;
+            auto p = file->begin() + (t.offset - file->offset());
+            auto e = file->begin() + (lex.offset() - file->offset());
+            for (; p < e; p++) {
+                if (p[0] == '\\' && (p[1] == '\n' || (p[1] == '\r' && p[2] == '\n')))
+                    p += p[1] == '\n' ? 1 : 2; // spliced lines
+                else
+                    s += *p;
+            }
+            return s;
+        }
+    }
+    return spell(t);
+}
+
+/* C99 6.10.3.2: the argument is spelled as written, with '"' and '\'
+ * escaped inside string literals and character constants only, and the
+ * result is read back as a string literal.
+ */
+Token kcc::Preprocessor::stringify(const std::vector<PPToken> &arg, uint32_t offset) {
+    std::string s = "\"";
+    for (size_t i = 0; i < arg.size(); i++) {
+        if (i && (arg[i].tok.flags & (Token::LeadingSpace | Token::StartOfLine)))
+            s += ' ';
+        auto text = spelling(arg[i].tok);
+        if (text.empty() || (text.back() != '"' && text.back() != '\'')) {
+            s += text;
+            continue;
+        }
+        for (auto c : text) {
+            if (c == '"' || c == '\\')
+                s += '\\';
+            s += c;
+        }
+    }
+    size_t backslashes = 0;
+    while (backslashes + 1 < s.size() && s[s.size() - 1 - backslashes] == '\\')
+        backslashes++;
+    if (backslashes % 2)
+        throw std::runtime_error(format("'#' gives the invalid string literal {}\"", s));
+    s += '"';
+    SourceFile buffer("<stringify>", s);
+    Lexer lex(buffer, true);
+    auto t = lex.get();
+    if (t.type != Token::Type::String || lex.get().type != Token::Type::Nil)
+        throw std::runtime_error(format("'#' gives the invalid string literal {}", s));
+    return Token(Token::Type::String, t.sym, offset);
+}
+
+Token kcc::Preprocessor::paste(const Token &a, const Token &b) {
+    auto text = spell(a) + spell(b);
+    SourceFile buffer("<paste>", text);
+    Lexer lex(buffer, true);
+    auto t = lex.get();
+    if (t.type == Token::Type::Nil || lex.get().type != Token::Type::Nil)
+        throw std::runtime_error(format("pasting \"{}\" and \"{}\" does not give a valid token",
+                                        spell(a), spell(b)));
+    t.offset = a.offset;
+    t.flags = a.flags;
+    return t;
+}
+
+void kcc::Preprocessor::directive(const Token &hash) {
+    auto name = lexRaw();
+    if (name.type == Token::Type::Nil || (name.flags & Token::StartOfLine)) {
+        // the null directive
+        if (name.type != Token::Type::Nil)
+            files.back().unread.push_back(name);
+        return;
+    }
+    where = name.offset;
+    auto line = readLine();
+    auto sym = name.sym;
+    if (files.back().guard != Guard::None)
+        guardDirective(sym, line);
+    if (sym == sInclude || sym == sIncludeNext) {
+        include(line, sym == sIncludeNext);
+    } else if (sym == sDefine) {
+        define(line);
+    } else if (sym == sUndef) {
+        if (line.empty() || !isName(line[0]))
+            throw std::runtime_error("macro name must be an identifier");
+        changed(line[0].sym);
+        if (line[0].sym < macros.size())
+            macros[line[0].sym].reset();
+    } else if (sym == sIf || sym == sIfdef || sym == sIfndef) {
+        // a condition in error is false, the group is skipped and its #endif still matches
+        bool value = false;
+        if (sym == sIf)
+            value = condition(line);
+        else if (line.empty() || !isName(line[0]))
+            error(where, "macro name must be an identifier");
+        else
+            value = (find(line[0]) != nullptr) == (sym == sIfdef);
+        conds.push_back(Cond{CondState::Then, value, hash.offset});
+        if (!value)
+            skipGroup();
+    } else if (sym == sElif) {
+        if (conds.size() <= files.back().conds || conds.back().state == CondState::Else)
+            throw std::runtime_error("#elif without #if");
+        auto &c = conds.back();
+        c.state = CondState::Elif;
+        if (!c.included && condition(line))
+            c.included = true;
+        else
+            skipGroup();
+    } else if (sym == sElse) {
+        if (conds.size() <= files.back().conds || conds.back().state == CondState::Else)
+            throw std::runtime_error("#else without #if");
+        auto &c = conds.back();
+        c.state = CondState::Else;
+        if (c.included)
+            skipGroup();
+        c.included = true;
+    } else if (sym == sEndif) {
+        if (conds.size() <= files.back().conds)
+            throw std::runtime_error("#endif without #if");
+        conds.pop_back();
+    } else if (sym == sPragma) {
+        if (!line.empty() && line[0].sym == sOnce && files.back().header)
+            files.back().header->once = true;
+        // other pragmas are ignored
+    } else if (sym == sError || sym == sWarning) {
+        std::string message;
+        for (auto &t : line) {
+            if (!message.empty() && (t.flags & Token::LeadingSpace))
+                message += ' ';
+            message += spell(t);
+        }
+        if (sym == sError)
+            throw std::runtime_error(format("#error {}", message));
+        warning(hash.offset, format("#warning {}", message));
+    } else if (sym == sLine) {
+        // line markers do not change positions
+    } else {
+        throw std::runtime_error(format("invalid preprocessing directive #{}", name.str()));
+    }
+}
+
+/* Follows the directives at the top level of a header for an include
+ * guard: #ifndef X or #if !defined X first, its #endif last, no #else or
+ * #elif. Once such a header ends, a later #include of it is skipped
+ * while X is defined.
+ */
+void kcc::Preprocessor::guardDirective(Symbol directive, const std::vector<Token> &line) {
+    auto &f = files.back();
+    if (f.guard == Guard::Start) {
+        f.guard = Guard::None;
+        if (directive == sIfndef && line.size() == 1 && isName(line[0])) {
+            f.guardMacro = line[0].sym;
+        } else if (directive == sIf && line.size() >= 3 && line[0].punct() == Punct::Not
+                   && line[1].sym == sDefined && line[1].type == Token::Type::Identifier) {
+            if (line.size() == 3 && isName(line[2]))
+                f.guardMacro = line[2].sym;
+            else if (line.size() == 5 && line[2].punct() == Punct::LParen && isName(line[3])
+                     && line[4].punct() == Punct::RParen)
+                f.guardMacro = line[3].sym;
+        }
+        if (f.guardMacro)
+            f.guard = Guard::Open;
+    } else if (f.guard == Guard::Closed) {
+        f.guard = Guard::None;
+    } else if (conds.size() == f.conds + 1) {
+        // the guard is the outermost conditional of the file
+        if (directive == sEndif)
+            f.guard = Guard::Closed;
+        else if (directive == sElif || directive == sElse)
+            f.guard = Guard::None;
+    }
+}
+
+/* Skips a group whose condition is false, up to the #elif, #else or
+ * #endif that belongs to it, which is then run as a normal directive.
+ * Text is scanned by Lexer::skipGroup() without being tokenized, tokens of
+ * a header read before are stepped over.
+ */
+void kcc::Preprocessor::skipGroup() {
+    auto &f = files.back();
+    int depth = 0;
+    while (true) {
+        if (f.lexer) {
+            if (!f.unread.empty()) {
+                // the first line of the group was lexed by readLine(), scan it again
+                f.lexer->seek(f.unread.back().offset);
+                f.unread.clear();
+                if (f.recording)
+                    f.recording->tokens.pop_back();
+            }
+            auto begin = f.lexer->offset();
+            bool found = f.lexer->skipGroup();
+            auto end = f.lexer->offset();
+            if (f.recording && end > begin) {
+                Token skipped(Token::Type::Skipped, end - begin, begin);
+                f.recording->tokens.push_back(skipped);
+            }
+            if (found) {
+                directive(lexRaw());
+                return;
+            }
+            if (!f.tokens)
+                return; // read() reports the open conditional
+            // the end of an included Skipped token, the group goes on in tokens
+            f.lexer.reset();
+            depth = 0;
+        }
+        // the file ended with the line of the directive, read() reports the open conditional
+        if (!f.tokens)
+            return;
+        if (!f.unread.empty()) {
+            f.unread.clear();
+            f.next--;
+        }
+        auto &toks = *f.tokens;
+        while (f.next < toks.size()) {
+            auto &t = toks[f.next++];
+            if (t.punct() != Punct::Hash || !(t.flags & Token::StartOfLine) || f.next == toks.size())
+                continue;
+            auto &name = toks[f.next];
+            if ((name.flags & Token::StartOfLine) || !isName(name))
+                continue;
+            auto sym = name.sym;
+            if (sym == sIf || sym == sIfdef || sym == sIfndef) {
+                depth++;
+            } else if (sym == sEndif && depth > 0) {
+                depth--;
+            } else if (depth == 0 && (sym == sElif || sym == sElse || sym == sEndif)) {
+                f.next--;
+                directive(lexRaw());
+                return;
+            }
+        }
+        return;
+    }
+}
+
+kcc::HeaderCache::Header *kcc::Preprocessor::findInclude(const std::string &name, bool quoted, int &dir) {
+    auto &cache = HeaderCache::get();
+    if (!name.empty() && name[0] == '/') {
+        dir = -1;
+        return cache.open(name);
+    }
+    if (quoted) {
+        std::string current = files.back().file->name();
+        auto slash = current.find_last_of('/');
+        auto path = slash == std::string::npos ? name : current.substr(0, slash + 1) + name;
+        if (auto h = cache.open(path)) {
+            dir = -1;
+            return h;
+        }
+    }
+    for (; dir < (int) includePaths.size(); dir++) {
+        if (auto h = cache.open(includePaths[dir] + "/" + name))
+            return h;
+    }
+    return nullptr;
+}
+
+void kcc::Preprocessor::include(const std::vector<Token> &line, bool next) {
+    std::vector<PPToken> tokens(line.begin(), line.end());
+    if (!line.empty() && line[0].type != Token::Type::String && line[0].punct() != Punct::Less)
+        tokens = expandList(tokens); // #include MACRO
+    std::string name;
+    bool quoted;
+    if (!tokens.empty() && tokens[0].tok.type == Token::Type::String) {
+        name = tokens[0].tok.str();
+        quoted = true;
+    } else if (!tokens.empty() && tokens[0].tok.punct() == Punct::Less) {
+        size_t i = 1;
+        for (; i < tokens.size() && tokens[i].tok.punct() != Punct::Greater; i++) {
+            if (i > 1 && (tokens[i].tok.flags & Token::LeadingSpace))
+                name += ' ';
+            name += spell(tokens[i].tok);
+        }
+        if (i == tokens.size())
+            throw std::runtime_error("missing terminating > character");
+        quoted = false;
+    } else {
+        throw std::runtime_error("#include expects \"FILENAME\" or <FILENAME>");
+    }
+    // #include_next goes on after the include path of the current file
+    int dir = next ? files.back().dir + 1 : 0;
+    bool local = quoted && !next;
+    // the result only depends on the name, where the search starts and, for "", the current file
+    auto key = format("{}\n{}\n{}", dir, local ? files.back().file->name() : "", name);
+    auto iter = resolved.find(key);
+    if (iter == resolved.end()) {
+        auto header = findInclude(name, local, dir);
+        if (!header)
+            throw std::runtime_error(format("'{}' file not found", name));
+        iter = resolved.insert(std::make_pair(key, Resolved{header, dir})).first;
+    }
+    auto header = iter->second.header;
+    if (dependencies && (header->id >= listed.size() || !listed[header->id])) {
+        if (listed.size() <= header->id)
+            listed.resize(header->id + 1);
+        listed[header->id] = true;
+        dependencies->add(header->file->name());
+    }
+    if (header->once && header->id < entered.size() && entered[header->id])
+        return;
+    if (header->guard && find(Token(Token::Type::Identifier, header->guard)))
+        return;
+    enter(header, iter->second.dir);
+}
+
+void kcc::Preprocessor::define(const std::vector<Token> &line) {
+    if (line.empty() || !isName(line[0]))
+        throw std::runtime_error("macro name must be an identifier");
+    std::unique_ptr<Macro> m(new Macro());
+    std::vector<Symbol> params;
+    size_t i = 1;
+    if (i < line.size() && line[i].punct() == Punct::LParen && !(line[i].flags & Token::LeadingSpace)) {
+        m->function = true;
+        i++;
+        while (i < line.size() && line[i].punct() != Punct::RParen) {
+            if (!params.empty()) {
+                if (line[i].punct() != Punct::Comma)
+                    throw std::runtime_error("expected ',' or ')' in macro parameter list");
+                i++;
+            }
+            if (i < line.size() && line[i].punct() == Punct::Ellipsis) {
+                params.push_back(sVaArgs);
+                m->variadic = true;
+                i++;
+                break;
+            }
+            if (i == line.size() || !isName(line[i]))
+                throw std::runtime_error("expected a macro parameter name");
+            params.push_back(line[i].sym);
+            i++;
+            if (i < line.size() && line[i].punct() == Punct::Ellipsis) {
+                // GNU named variadic parameter, args...
+                m->variadic = true;
+                i++;
+                break;
+            }
+        }
+        if (i == line.size() || line[i].punct() != Punct::RParen)
+            throw std::runtime_error("missing ')' in macro parameter list");
+        i++;
+    }
+    m->params = (int) params.size();
+    m->body.assign(line.begin() + i, line.end());
+    for (auto &t : m->body) {
+        int p = -1;
+        if (isName(t)) {
+            auto iter = std::find(params.begin(), params.end(), t.sym);
+            if (iter != params.end())
+                p = (int) (iter - params.begin());
+        }
+        m->param.push_back(p);
+    }
+    auto &body = m->body;
+    if (!body.empty() && (body.front().punct() == Punct::HashHash || body.back().punct() == Punct::HashHash))
+        throw std::runtime_error("'##' cannot appear at either end of a macro expansion");
+    for (size_t j = 0; m->function && j < body.size(); j++) {
+        if (body[j].punct() == Punct::Hash && (j + 1 == body.size() || m->param[j + 1] < 0))
+            throw std::runtime_error("'#' is not followed by a macro parameter");
+    }
+    auto sym = line[0].sym;
+    if (macros.size() <= sym)
+        macros.resize(sym + 1);
+    changed(sym);
+    macros[sym] = std::move(m);
+}
+
+namespace {
+    // a value of an #if expression: intmax_t or uintmax_t, held as the bits of the latter
+    struct CondValue {
+        uint64_t bits;
+        bool isUnsigned;
+
+        long long asSigned() const { return (long long) bits; }
+
+        static CondValue of(bool b) { return {b, false}; }
+    };
+
+    /* #if expressions, evaluated as C11 6.10.1p4 asks: every integer has the
+     * type intmax_t or uintmax_t, here long long or unsigned long long, and
+     * the usual arithmetic conversions make an operation unsigned when either
+     * operand is. Signed arithmetic is done on the bits and checked, so what
+     * overflows wraps around and is reported as gcc does.
+     */
+    class CondExpr {
+        const std::vector<PPToken> &toks;
+        size_t i;
+
+        Punct punct() const { return i < toks.size() ? toks[i].tok.punct() : Punct::None; }
+
+        void expect(Punct p, const char *spelling) {
+            if (punct() != p)
+                throw std::runtime_error(format("expected '{}' in preprocessor expression", spelling));
+            i++;
+        }
+
+        static int precedence(Punct p) {
+            switch (p) {
+                case Punct::Star:
+                case Punct::Slash:
+                case Punct::Percent:
+                    return 10;
+                case Punct::Plus:
+                case Punct::Minus:
+                    return 9;
+                case Punct::ShiftLeft:
+                case Punct::ShiftRight:
+                    return 8;
+                case Punct::Less:
+                case Punct::Greater:
+                case Punct::LessEqual:
+                case Punct::GreaterEqual:
+                    return 7;
+                case Punct::Equal:
+                case Punct::NotEqual:
+                    return 6;
+                case Punct::Amp:
+                    return 5;
+                case Punct::Caret:
+                    return 4;
+                case Punct::Pipe:
+                    return 3;
+                case Punct::AndAnd:
+                    return 2;
+                case Punct::OrOr:
+                    return 1;
+                default:
+                    return 0;
+            }
+        }
+
+        void overflow(bool live) {
+            if (live)
+                overflowed = true;
+        }
+
+        // live is false on the side a short circuit skips, nothing is reported there
+        CondValue unary(bool live) {
+            if (i == toks.size())
+                throw std::runtime_error("expected value in preprocessor expression");
+            auto &t = toks[i++].tok;
+            switch (t.punct()) {
+                case Punct::Plus:
+                    return unary(live);
+                case Punct::Minus: {
+                    auto v = unary(live);
+                    if (!v.isUnsigned && v.bits == (uint64_t) LLONG_MIN)
+                        overflow(live);
+                    return {0 - v.bits, v.isUnsigned};
+                }
+                case Punct::Not:
+                    return CondValue::of(unary(live).bits == 0);
+                case Punct::Tilde: {
+                    auto v = unary(live);
+                    return {~v.bits, v.isUnsigned};
+                }
+                case Punct::LParen: {
+                    auto v = ternary(live);
+                    expect(Punct::RParen, ")");
+                    return v;
+                }
+                default:
+                    break;
+            }
+            if (t.type == Token::Type::Int) {
+                // a constant too large for intmax_t can only be uintmax_t
+                auto v = Interner::get().value(t.sym);
+                return {v, (t.code & Token::Unsigned) || v > (uint64_t) LLONG_MAX};
+            }
+            if (t.type == Token::Type::Identifier || t.type == Token::Type::Keyword)
+                return {0, false};
+            throw std::runtime_error(format("token '{}' is not valid in preprocessor expressions",
+                                            Preprocessor::spell(t)));
+        }
+
+        CondValue divide(Punct op, CondValue lhs, CondValue rhs, bool live) {
+            if (rhs.bits == 0) {
+                if (live)
+                    throw std::runtime_error("division by zero in preprocessor expression");
+                return {0, lhs.isUnsigned};
+            }
+            bool isRem = op == Punct::Percent;
+            if (lhs.isUnsigned)
+                return {isRem ? lhs.bits % rhs.bits : lhs.bits / rhs.bits, true};
+            // LLONG_MIN / -1 does not fit and traps on x86, LLONG_MIN % -1 with it
+            if (rhs.asSigned() == -1) {
+                if (!isRem && lhs.bits == (uint64_t) LLONG_MIN)
+                    overflow(live);
+                return {isRem ? 0 : 0 - lhs.bits, false};
+            }
+            return {(uint64_t) (isRem ? lhs.asSigned() % rhs.asSigned() : lhs.asSigned() / rhs.asSigned()), false};
+        }
+
+        // the result has the type of the promoted left operand
+        CondValue shift(Punct op, CondValue lhs, CondValue rhs, bool live) {
+            if (rhs.isUnsigned ? rhs.bits >= 64 : (rhs.asSigned() < 0 || rhs.asSigned() >= 64)) {
+                if (live)
+                    throw std::runtime_error(format("shift count {} is out of range in preprocessor expression",
+                                                    rhs.isUnsigned ? std::to_string(rhs.bits)
+                                                                   : std::to_string(rhs.asSigned())));
+                return {0, lhs.isUnsigned};
+            }
+            auto n = (unsigned) rhs.bits;
+            if (op == Punct::ShiftRight) {
+                if (lhs.isUnsigned)
+                    return {lhs.bits >> n, true};
+                // arithmetic, as gcc does
+                return {(uint64_t) (lhs.asSigned() < 0 ? ~(~lhs.asSigned() >> n) : lhs.asSigned() >> n), false};
+            }
+            uint64_t bits = lhs.bits << n;
+            if (!lhs.isUnsigned) {
+                // the bits shifted out and the sign bit must all be copies of the sign
+                long long back = (long long) bits < 0 ? ~(~(long long) bits >> n) : (long long) bits >> n;
+                if (back != lhs.asSigned())
+                    overflow(live);
+            }
+            return {bits, lhs.isUnsigned};
+        }
+
+        // signed overflow is read off the sign bits of the wrapped result
+        CondValue arithmetic(Punct op, CondValue lhs, CondValue rhs, bool live) {
+            bool isUnsigned = lhs.isUnsigned || rhs.isUnsigned;
+            lhs.isUnsigned = rhs.isUnsigned = isUnsigned;
+            long long a = lhs.asSigned(), b = rhs.asSigned();
+            switch (op) {
+                case Punct::Star: {
+                    CondValue r = {lhs.bits * rhs.bits, isUnsigned};
+                    if (!isUnsigned && a != 0 && (a == -1 ? b == LLONG_MIN : r.asSigned() / a != b))
+                        overflow(live);
+                    return r;
+                }
+                case Punct::Slash:
+                case Punct::Percent:
+                    return divide(op, lhs, rhs, live);
+                case Punct::Plus: {
+                    CondValue r = {lhs.bits + rhs.bits, isUnsigned};
+                    if (!isUnsigned && (a < 0) == (b < 0) && (r.asSigned() < 0) != (a < 0))
+                        overflow(live);
+                    return r;
+                }
+                case Punct::Minus: {
+                    CondValue r = {lhs.bits - rhs.bits, isUnsigned};
+                    if (!isUnsigned && (a < 0) != (b < 0) && (r.asSigned() < 0) != (a < 0))
+                        overflow(live);
+                    return r;
+                }
+                case Punct::Less:
+                    return CondValue::of(isUnsigned ? lhs.bits < rhs.bits : a < b);
+                case Punct::Greater:
+                    return CondValue::of(isUnsigned ? lhs.bits > rhs.bits : a > b);
+                case Punct::LessEqual:
+                    return CondValue::of(isUnsigned ? lhs.bits <= rhs.bits : a <= b);
+                case Punct::GreaterEqual:
+                    return CondValue::of(isUnsigned ? lhs.bits >= rhs.bits : a >= b);
+                case Punct::Equal:
+                    return CondValue::of(lhs.bits == rhs.bits);
+                case Punct::NotEqual:
+                    return CondValue::of(lhs.bits != rhs.bits);
+                case Punct::Amp:
+                    return {lhs.bits & rhs.bits, isUnsigned};
+                case Punct::Caret:
+                    return {lhs.bits ^ rhs.bits, isUnsigned};
+                case Punct::Pipe:
+                    return {lhs.bits | rhs.bits, isUnsigned};
+                default:
+                    return lhs;
+            }
+        }
+
+        CondValue binary(int minPrec, bool live) {
+            auto lhs = unary(live);
+            while (true) {
+                auto op = punct();
+                int prec = precedence(op);
+                if (prec < minPrec || prec == 0)
+                    return lhs;
+                i++;
+                bool rhsLive = live && !(op == Punct::AndAnd && !lhs.bits) && !(op == Punct::OrOr && lhs.bits);
+                auto rhs = binary(prec + 1, rhsLive);
+                if (op == Punct::AndAnd)
+                    lhs = CondValue::of(lhs.bits && rhs.bits);
+                else if (op == Punct::OrOr)
+                    lhs = CondValue::of(lhs.bits || rhs.bits);
+                else if (op == Punct::ShiftLeft || op == Punct::ShiftRight)
+                    lhs = shift(op, lhs, rhs, live);
+                else
+                    lhs = arithmetic(op, lhs, rhs, live);
+            }
+        }
+
+        // both arms are converted to a common type, taken or not
+        CondValue ternary(bool live) {
+            auto c = binary(1, live);
+            if (punct() != Punct::Question)
+                return c;
+            i++;
+            auto a = ternary(live && c.bits);
+            expect(Punct::Colon, ":");
+            auto b = ternary(live && !c.bits);
+            return {c.bits ? a.bits : b.bits, a.isUnsigned || b.isUnsigned};
+        }
+
+    public:
+        bool overflowed; // a signed operation on the live side wrapped around
+
+        explicit CondExpr(const std::vector<PPToken> &_toks) : toks(_toks), i(0), overflowed(false) {}
+
+        CondValue eval() {
+            auto v = ternary(true);
+            if (i != toks.size())
+                throw std::runtime_error(format("unexpected '{}' in preprocessor expression",
+                                                Preprocessor::spell(toks[i].tok)));
+            return v;
+        }
+    };
+}
+
+// an expression in error is reported and taken as false
+bool kcc::Preprocessor::condition(const std::vector<Token> &line) {
+    try {
+        return evaluate(line);
+    } catch (std::runtime_error &e) {
+        error(where, e.what());
+        return false;
+    }
+}
+
+bool kcc::Preprocessor::evaluate(const std::vector<Token> &line) {
+    std::vector<PPToken> toks;
+    for (size_t i = 0; i < line.size(); i++) {
+        if (line[i].sym != sDefined || line[i].type != Token::Type::Identifier) {
+            toks.emplace_back(line[i]);
+            continue;
+        }
+        bool paren = i + 1 < line.size() && line[i + 1].punct() == Punct::LParen;
+        size_t j = paren ? i + 2 : i + 1;
+        if (j >= line.size() || !isName(line[j]))
+            throw std::runtime_error("macro name must be an identifier");
+        if (paren && (j + 1 >= line.size() || line[j + 1].punct() != Punct::RParen))
+            throw std::runtime_error("missing ')' after 'defined'");
+        toks.emplace_back(intToken(find(line[j]) != nullptr, line[i].offset));
+        i = paren ? j + 1 : j;
+    }
+    if (toks.empty())
+        throw std::runtime_error("#if with no expression");
+    auto operands = expandList(toks);
+    CondExpr expr(operands);
+    bool value = expr.eval().bits != 0;
+    if (expr.overflowed)
+        warning(where, "integer overflow in preprocessor expression");
+    return value;
+}
+
+/* An error is reported where it was met and reading goes on after it: a
+ * directive in error has been read to the end of its line, an invocation
+ * to its ')'.
+ */
+PPToken kcc::Preprocessor::expandChecked() {
+    while (true) {
+        try {
+            return expand();
+        } catch (std::runtime_error &e) {
+            error(where, e.what());
+        }
+    }
+}
+
+Token kcc::Preprocessor::get() {
+    auto t = pending;
+    pending = Token();
+    if (t.type == Token::Type::Nil)
+        t = expandChecked().tok;
+    if (t.type != Token::Type::String || !joinStrings)
+        return t;
+    // adjacent string literals are joined once macros are expanded
+    bool joined = false;
+    while (true) {
+        auto next = expandChecked().tok;
+        if (next.type != Token::Type::String) {
+            pending = next;
+            break;
+        }
+        if (!joined)
+            literal = t.str();
+        literal += next.str();
+        joined = true;
+    }
+    if (joined)
+        t.sym = Interner::get().intern(literal);
+    return t;
+}
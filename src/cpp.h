@@ -7,10 +7,287 @@
 #define KCC_CPP_H
 
 #include "kcc.h"
-struct PPToken{
-    char * filename;
-    int line,col;
-};
+#include "lex.h"
+#include <map>
+#include <tuple>
 
+namespace kcc {
+    // a token on its way through macro expansion
+    struct PPToken {
+        Token tok;
+        uint32_t hideset; // see HideSets, 0 is the empty set
+
+        PPToken() : hideset(0) {}
+
+        PPToken(const Token &t, uint32_t h = 0) : tok(t), hideset(h) {}
+    };
+
+    /* Hide sets of Prosser's expansion algorithm, the names of the macros a
+     * token came out of. Every distinct set is stored once and referred to
+     * by id, unions and intersections are memoized.
+     */
+    class HideSets {
+        std::vector<std::vector<Symbol>> sets; // sorted
+        std::map<std::vector<Symbol>, uint32_t> ids;
+        std::unordered_map<uint64_t, uint32_t> additions, unions, intersections;
+
+        uint32_t make(const std::vector<Symbol> &set);
+
+    public:
+        HideSets();
+
+        bool contains(uint32_t set, Symbol sym) const {
+            auto &s = sets[set];
+            return std::binary_search(s.begin(), s.end(), sym);
+        }
+
+        uint32_t add(uint32_t set, Symbol sym);
+
+        uint32_t unite(uint32_t a, uint32_t b);
+
+        uint32_t intersect(uint32_t a, uint32_t b);
+    };
+
+    struct Macro {
+        bool function;
+        bool variadic; // the last parameter is __VA_ARGS__
+        int params;
+        int builtin; // __FILE__ or __LINE__, expanded on the fly
+        std::vector<Token> body;
+        std::vector<int> param; // parameter index of each body token, -1 for none
+
+        Macro() : function(false), variadic(false), params(0), builtin(0) {}
+    };
+
+    // FNV-1a over the words of a memo key
+    struct MemoKeyHash {
+        size_t operator()(const std::vector<uint32_t> &key) const {
+            uint64_t h = 14695981039346656037ull;
+            for (auto w : key) {
+                h ^= w;
+                h *= 1099511628211ull;
+            }
+            return (size_t) h;
+        }
+    };
+
+    /* Headers read by this process, keyed by device, inode, size and mtime.
+     * A header is mapped and lexed once however often it is included, also
+     * across translation units compiled by one process. Groups skipped on
+     * the first read are kept as Skipped tokens and only lexed if a later
+     * read includes them. Not thread-safe.
+     */
+    class HeaderCache {
+    public:
+        struct Header {
+            uint32_t id;
+            SourceFile *file; // owned by the SourceManager
+            std::vector<Token> tokens; // raw tokens, recorded by the first #include
+            bool lexed; // tokens is complete
+            bool recording; // a Preprocessor is reading the file for the first time
+            bool once; // has #pragma once
+            Symbol guard; // macro of an include guard around the whole file, 0 for none
+
+            Header() : id(0), file(nullptr), lexed(false), recording(false), once(false), guard(0) {}
+        };
+
+    private:
+        struct Key {
+            uint64_t dev, ino, size, mtime;
+
+            bool operator<(const Key &k) const {
+                return std::tie(dev, ino, size, mtime) < std::tie(k.dev, k.ino, k.size, k.mtime);
+            }
+        };
+        std::map<Key, Header *> byKey;
+        std::vector<std::unique_ptr<Header>> headers; // indexed by id
+
+    public:
+        // returns nullptr if path is not a readable file
+        Header *open(const std::string &path);
+
+        size_t size() const { return headers.size(); }
+
+        static HeaderCache &get();
+    };
+
+    /* Writes the make rule of -MD: the target depends on the main file and
+     * on every header the Preprocessor resolves, added as it resolves them.
+     * Output is buffered and written in large blocks.
+     */
+    class DependencyWriter {
+        FILE *out;
+        std::string buffer;
+
+        DependencyWriter(FILE *_out) : out(_out) {}
+
+        void append(const std::string &path);
+
+        void flush();
+
+    public:
+        // returns nullptr if path cannot be written
+        static DependencyWriter *open(const std::string &path, const std::string &target, const std::string &source);
+
+        void add(const std::string &path);
+
+        ~DependencyWriter();
+    };
+
+    /* Sits between the Lexer and the Parser: runs directives, expands
+     * macros and joins adjacent string literals.
+     * Each file is read by a raw Lexer, tokens out of macro expansions wait
+     * on a stack, so no token is copied more than once and no text is.
+     */
+    class Preprocessor : public TokenSource {
+        // how far a file matches #ifndef X ... #endif with nothing outside
+        enum class Guard {
+            Start, Open, Closed, None
+        };
+        struct File {
+            std::unique_ptr<Lexer> lexer; // reads text, before tokens if both are set
+            const std::vector<Token> *tokens; // a header lexed before or a scanned main file
+            size_t next; // index into tokens
+            std::unique_ptr<std::vector<Token>> scanned; // tokens of a main file lexed in parallel
+            HeaderCache::Header *header; // nullptr for the main file
+            HeaderCache::Header *recording; // the header whose tokens lexer records
+            const SourceFile *file;
+            size_t conds; // conditionals open when the file was entered
+            int dir; // index of the include path the file was found in, -1 for none
+            Guard guard;
+            Symbol guardMacro;
+            std::vector<Token> unread; // raw tokens put back
+        };
+        struct Resolved {
+            HeaderCache::Header *header;
+            int dir;
+        };
+        enum class CondState {
+            Then, Elif, Else
+        };
+        struct Cond {
+            CondState state;
+            bool included; // a group of this conditional has been included
+            uint32_t offset;
+        };
+        std::vector<File> files;
+        std::vector<Cond> conds;
+        std::vector<PPToken> expanded; // results of expansions, top is next
+        size_t floor; // expanded below this belongs to an outer expandList()
+        bool bounded; // reading an isolated list, stop at floor
+        std::vector<std::unique_ptr<Macro>> macros; // indexed by Symbol
+        HideSets hidesets;
+        /* Substitutions done before, keyed by the macro, the hide set and the
+         * type, flags, symbol and hide set of every argument token. Entries
+         * depend on the names looked up while they were made, a #define or
+         * #undef of one of those empties the memo. A substitution is only
+         * kept the second time its key hash is seen, so invocations that
+         * never repeat cost a hash and not an entry.
+         */
+        std::unordered_map<std::vector<uint32_t>, std::vector<PPToken>, MemoKeyHash> memo;
+        std::vector<uint32_t> memoKey; // reused to look up
+        std::vector<size_t> memoSeen; // key hashes, direct mapped
+        std::vector<bool> memoDeps; // by Symbol
+        int memoDepth; // substitutions being made
+        bool memoBuiltin; // __FILE__ or __LINE__ was expanded, the substitution is not kept
+        std::vector<bool> entered; // by header id
+        std::vector<bool> listed; // by header id, given to dependencies
+        std::unordered_map<std::string, Resolved> resolved; // #include lookups done so far
+        std::string predefines;
+        std::string literal;
+        Token pending;
+        uint32_t where; // offset of the last token read, for diagnostics
+
+        Symbol sInclude, sIncludeNext, sDefine, sUndef, sIf, sIfdef, sIfndef, sElif, sElse, sEndif;
+        Symbol sPragma, sError, sWarning, sLine, sDefined, sOnce, sVaArgs;
+
+        enum Builtin {
+            NoBuiltin, FileMacro, LineMacro
+        };
+
+        void enter(const SourceFile &file, int lexThreads);
+
+        void enter(HeaderCache::Header *header, int dir);
+
+        void guardDirective(Symbol directive, const std::vector<Token> &line);
+
+        Token lexRaw();
+
+        PPToken read();
+
+        PPToken expand();
+
+        PPToken expandChecked();
+
+        void unget(const PPToken &t);
+
+        std::vector<Token> readLine();
+
+        std::vector<PPToken> expandList(const std::vector<PPToken> &list);
+
+        Macro *find(const Token &t) const {
+            if (t.type != Token::Type::Identifier && t.type != Token::Type::Keyword)
+                return nullptr;
+            return t.sym < macros.size() ? macros[t.sym].get() : nullptr;
+        }
+
+        void substitute(const Macro &m, std::vector<std::vector<PPToken>> &args, uint32_t hideset,
+                        const Token &name);
+
+        std::vector<PPToken> replace(const Macro &m, std::vector<std::vector<PPToken>> &args, uint32_t hideset,
+                                     const Token &name);
+
+        void changed(Symbol macro);
+
+        Token stringify(const std::vector<PPToken> &arg, uint32_t offset);
+
+        // the token as written in source, or as spell() gives it if it was made by expansion
+        static std::string spelling(const Token &t);
+
+        Token paste(const Token &a, const Token &b);
+
+        void directive(const Token &hash);
+
+        void include(const std::vector<Token> &line, bool next);
+
+        // searches includePaths from dir on, stores where the file was found in dir
+        HeaderCache::Header *findInclude(const std::string &name, bool quoted, int &dir);
+
+        void define(const std::vector<Token> &line);
+
+        bool condition(const std::vector<Token> &line);
+
+        bool evaluate(const std::vector<Token> &line);
+
+        void skipGroup();
+
+        void defineBuiltin(const char *name, int builtin);
+
+        void error(uint32_t offset, const std::string &message);
+
+        void warning(uint32_t offset, const std::string &message);
+
+        friend class PCH;
+
+    public:
+        std::vector<std::string> includePaths;
+        DependencyWriter *dependencies; // not owned, may be nullptr
+        int errors; // reported so far, reading goes on after each
+        bool joinStrings; // adjacent string literals come out as one, translation phase 6; false for -E
+
+        Preprocessor();
+
+        // -D, defines name as value before the main file is read
+        void define(const std::string &name, const std::string &value);
+
+        // starts reading the main file, lexThreads as in Lexer::scanParallel
+        void push(const SourceFile &file, int lexThreads = 1);
+
+        Token get() override;
+
+        // the token as it could be written in source
+        static std::string spell(const Token &t);
+    };
+}
 
 #endif //KCC_CPP_H
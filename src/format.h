@@ -34,6 +34,15 @@ struct Formatter<int>{
     }
 };
 
+template<>
+struct Formatter<long long>{
+    const char *str(long long i) {
+        char *s = new char[24];
+        sprintf(s, "%lld", i);
+        return s;
+    }
+};
+
 template<>
 struct Formatter<char>{
     const char *str(char i) {
@@ -0,0 +1,59 @@
+#include "intern.h"
+#include <cstring>
+
+using namespace kcc;
+
+kcc::Interner::Interner() {
+    table.resize(1024, 0);
+    intern("", 0);
+}
+
+Interner &kcc::Interner::get() {
+    static Interner interner;
+    return interner;
+}
+
+uint32_t kcc::Interner::hash(const char *s, size_t len) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void kcc::Interner::grow() {
+    std::vector<Symbol> t(table.size() * 2, 0);
+    auto mask = t.size() - 1;
+    for (Symbol sym = 0; sym < spellings.size(); sym++) {
+        auto i = hashes[sym] & mask;
+        while (t[i])
+            i = (i + 1) & mask;
+        t[i] = sym + 1;
+    }
+    table.swap(t);
+}
+
+Symbol kcc::Interner::intern(const char *s, size_t len) {
+    auto h = hash(s, len);
+    auto mask = table.size() - 1;
+    auto i = h & mask;
+    while (table[i]) {
+        auto sym = table[i] - 1;
+        if (hashes[sym] == h) {
+            auto &spelling = spellings[sym];
+            if (spelling.size() == len && memcmp(spelling.data(), s, len) == 0)
+                return sym;
+        }
+        i = (i + 1) & mask;
+    }
+    auto sym = (Symbol) spellings.size();
+    spellings.emplace_back(s, len);
+    hashes.push_back(h);
+    values.push_back(0);
+    table[i] = sym + 1;
+    if (spellings.size() * 2 > table.size())
+        grow();
+    return sym;
+}
@@ -0,0 +1,45 @@
+// Unique spellings of tokens
+
+#ifndef KCC_INTERN_H
+#define KCC_INTERN_H
+
+#include "kcc.h"
+
+namespace kcc {
+    typedef uint32_t Symbol;
+
+    /* Maps every distinct spelling to a small integer.
+     * Symbol 0 is always the empty string.
+     * Returned references stay valid for the lifetime of the table.
+     * Each symbol also carries a 64 bit payload; numeric literals keep
+     * their binary value there so nothing after the lexer parses text.
+     */
+    class Interner {
+        std::deque<std::string> spellings;
+        std::vector<uint32_t> hashes;
+        std::vector<uint64_t> values;
+        std::vector<Symbol> table; // open addressing, holds symbol + 1, 0 for empty slots
+
+        static uint32_t hash(const char *s, size_t len);
+
+        void grow();
+
+    public:
+        Interner();
+
+        Symbol intern(const char *s, size_t len);
+
+        Symbol intern(const std::string &s) { return intern(s.data(), s.size()); }
+
+        const std::string &str(Symbol sym) const { return spellings[sym]; }
+
+        uint64_t value(Symbol sym) const { return values[sym]; }
+
+        void setValue(Symbol sym, uint64_t v) { values[sym] = v; }
+
+        size_t size() const { return spellings.size(); }
+
+        static Interner &get();
+    };
+}
+#endif //KCC_INTERN_H
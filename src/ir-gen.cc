@@ -6,10 +6,6 @@
 
 using namespace kcc;
 
-void kcc::IRGenerator::visit(kcc::For *aFor) {
-
-}
-
 void kcc::IRGenerator::visit(kcc::Identifier *identifier) {
     if (identifier->isGlobal) {
         emit(Opcode::loadGlobal, identifier->getReg(), identifier->tok());
@@ -19,18 +15,18 @@ void kcc::IRGenerator::visit(kcc::Identifier *identifier) {
 
 void kcc::IRGenerator::visit(kcc::While *aWhile) {
     int begin = (int) ir().size();
-    aWhile->cond()->accept(this);
+    dispatch(aWhile->cond());
     auto cond = aWhile->cond()->getReg();
     int branchIdx = (int) ir().size();
     emit(Opcode::branch, cond);
-    aWhile->body()->accept(this);
+    dispatch(aWhile->body());
     emit(Opcode::jmp, Value(begin));
     patch(branchIdx, Opcode::branch, cond, Value(branchIdx + 1), Value((int)ir().size()));
 }
 
 void kcc::IRGenerator::visit(kcc::Block *block) {
     for (auto i:*block) {
-        i->accept(this);
+        dispatch(i);
     }
 }
 
@@ -39,73 +35,51 @@ void kcc::IRGenerator::visit(kcc::TopLevel *level) {
 }
 
 void kcc::IRGenerator::visit(kcc::If *anIf) {
-    anIf->cond()->accept(this);
+    dispatch(anIf->cond());
     auto cond = anIf->cond()->getReg();
     int branchIdx = (int)ir().size();
     emit(Opcode::branch, cond);
-    anIf->body()->accept(this);
+    dispatch(anIf->body());
     int jmpIdx = (int) ir().size();
     emit(Opcode::jmp, Value(0));
     int a = (int) ir().size();
     if (anIf->size() == 3) {
-        anIf->elsePart()->accept(this);
+        dispatch(anIf->elsePart());
     }
     patch(branchIdx, Opcode::branch, cond, Value(branchIdx + 1), Value(a));
     patch(jmpIdx, Opcode::jmp, Value((int)ir().size()));
 
 }
 
-void kcc::IRGenerator::visit(kcc::TernaryExpression *expression) {
-
-}
-
 void kcc::IRGenerator::visit(kcc::Number *number) {
     if (number->isFloat)
-        emit(Opcode::fconst, number->getReg(), Value(std::stod(number->tok())));
+        emit(Opcode::fconst, number->getReg(), Value(number->getFloat()));
     else
-        emit(Opcode::iconst, number->getReg(), Value(std::stoi(number->tok())));
+        emit(Opcode::iconst, number->getReg(), Value(number->getInt()));
 }
 
 void kcc::IRGenerator::visit(kcc::Return *aReturn) {
-    aReturn->first()->accept(this);
+    dispatch(aReturn->first());
     emit(Opcode::ret, aReturn->first()->getReg());
 }
 
-void kcc::IRGenerator::visit(kcc::Empty *empty) {
-
-}
-
-void kcc::IRGenerator::visit(kcc::PrimitiveType *type) {
-
-}
-
-void kcc::IRGenerator::visit(kcc::PointerType *type) {
-
-}
-
-void kcc::IRGenerator::visit(kcc::ArrayType *type) {
-
-}
-
 void kcc::IRGenerator::visit(kcc::ArgumentExepressionList *list) {
     for (auto i:*list) {
-        i->accept(this);
+        dispatch(i);
     }
 }
 
-void kcc::IRGenerator::visit(kcc::FuncDefArg *arg) {
-
-}
-
 void kcc::IRGenerator::visit(kcc::FuncDef *def) {
+    if (def->deferred()) // never referenced, nothing to emit
+        return;
     auto funcName = def->name();
     funcs.emplace_back(Function(funcName,    def->frameSize));
-    def->block()->accept(this);
+    dispatch(def->block());
 }
 
 void kcc::IRGenerator::visit(kcc::CallExpression *expression) {
     auto arg = expression->arg();
-    arg->accept(this);
+    dispatch(arg);
     int a = 0, b = 0;
     for (auto i:*arg) {
         if (i->isFloat) {
@@ -115,34 +89,43 @@ void kcc::IRGenerator::visit(kcc::CallExpression *expression) {
         }
     }
     auto callee = expression->callee();
-    if(callee->kind() == Identifier().kind() && callee->isGlobal) {
+    if(isa<Identifier>(callee) && callee->isGlobal) {
         emit(Opcode::callGlobal,callee->tok());
     }
 }
 
-void kcc::IRGenerator::visit(kcc::CastExpression *expression) {
-
-}
-
-void kcc::IRGenerator::visit(kcc::IndexExpression *expression) {
-
-}
-
-void kcc::IRGenerator::visit(kcc::Declaration *declaration) {
-
-}
-
-void kcc::IRGenerator::visit(kcc::DeclarationList *list) {
-
-}
-
 void kcc::IRGenerator::visit(kcc::Literal *literal) {
     emit(Opcode::sconst, literal->getReg(), literal->tok());
 }
 
+/* Operands are evaluated right to left. Down a chain like a + b + c + ...
+ * each right operand is evaluated on the way to the leftmost one, then the
+ * operators are emitted bottom up, so long chains take no C++ stack.
+ */
 void kcc::IRGenerator::visit(kcc::BinaryExpression *expression) {
-    expression->rhs()->accept(this);
+    auto base = chain.size();
+    for (auto e = expression; e;) {
+        chain.push_back(e);
+        dispatch(e->rhs());
+        if (e->tok() == "=") // the target is not evaluated
+            break;
+        auto lhs = dyn_cast<BinaryExpression>(e->lhs());
+        if (!lhs)
+            dispatch(e->lhs());
+        e = lhs;
+    }
+    for (auto i = chain.size(); i-- > base;)
+        emitBinaryExpression(chain[i]);
+    chain.resize(base);
+}
+
+void kcc::IRGenerator::unsupported(kcc::BinaryExpression *expression) {
+    fprintln(stderr, "{}: error: operator '{}' is not supported yet", expression->getPos(), expression->tok());
+    errors++;
+}
 
+// emits expression, its operands have been evaluated
+void kcc::IRGenerator::emitBinaryExpression(kcc::BinaryExpression *expression) {
     auto &op = expression->tok();
     if (op == "=") {
         if (expression->lhs()->isFloat && !expression->rhs()->isFloat) {
@@ -151,11 +134,10 @@ void kcc::IRGenerator::visit(kcc::BinaryExpression *expression) {
         if (!expression->lhs()->isFloat && expression->rhs()->isFloat) {
             emit(Opcode::cvtf2i, expression->rhs()->getReg(), expression->rhs()->getReg());
         }
-        if (expression->lhs()->kind() == Identifier().kind()) {
+        if (isa<Identifier>(expression->lhs())) {
             emit(Opcode::store, expression->lhs()->getAddr(), expression->rhs()->getReg());
         }
     } else {
-        expression->lhs()->accept(this);
         if (expression->lhs()->isFloat || expression->rhs()->isFloat) {
             if (!expression->lhs()->isFloat) {
                 emit(Opcode::cvti2f, expression->lhs()->getReg(),
@@ -165,7 +147,7 @@ void kcc::IRGenerator::visit(kcc::BinaryExpression *expression) {
                 emit(Opcode::cvti2f, expression->rhs()->getReg(),
                      expression->rhs()->getReg());
             }
-            Opcode opcode;
+            auto opcode = Opcode::nop; // for the operators below only
             if (op == "+") {
                 opcode = Opcode::fadd;
             } else if (op == "-") {
@@ -187,11 +169,15 @@ void kcc::IRGenerator::visit(kcc::BinaryExpression *expression) {
             } else if (op == "!=") {
                 opcode = Opcode::fne;
             }
+            if (opcode == Opcode::nop) {
+                unsupported(expression);
+                return;
+            }
             emit(opcode, expression->getReg(),
                  expression->lhs()->getReg(),
                  expression->rhs()->getReg());
         } else {
-            Opcode opcode;
+            auto opcode = Opcode::nop; // for the operators below only
             if (op == "+") {
                 opcode = Opcode::iadd;
             } else if (op == "-") {
@@ -213,6 +199,10 @@ void kcc::IRGenerator::visit(kcc::BinaryExpression *expression) {
             } else if (op == "!=") {
                 opcode = Opcode::ine;
             }
+            if (opcode == Opcode::nop) {
+                unsupported(expression);
+                return;
+            }
             emit(opcode, expression->getReg(),
                  expression->lhs()->getReg(),
                  expression->rhs()->getReg());
@@ -220,28 +210,25 @@ void kcc::IRGenerator::visit(kcc::BinaryExpression *expression) {
     }
 }
 
-void kcc::IRGenerator::visit(kcc::UnaryExpression *expression) {
-
-}
-
-void kcc::IRGenerator::pre(kcc::AST *ast) {
-
-}
-
-void kcc::IRGenerator::visit(kcc::Enum *anEnum) {
-
-}
-
-void kcc::IRGenerator::visit(kcc::FuncType *type) {
-
+static void printFunction(Writer &out, const Function &func) {
+    int cnt = 0;
+    for (auto &i : func.ir) {
+        out.print("{}: ", cnt++);
+        i.dump(out);
+        out.put('\n');
+    }
 }
 
-void kcc::IRGenerator::visit(kcc::PostfixExpr *expr) {
-
+void IRGenerator::printIR(Writer &out) const {
+    if (!funcs.empty())
+        printFunction(out, funcs.back());
 }
 
-void kcc::IRGenerator::visit(kcc::FuncArgType *type) {
-
+void IRGenerator::dumpIR(Writer &out) const {
+    for (auto &func : funcs) {
+        out.print("{}:\n", func.name);
+        printFunction(out, func);
+    }
 }
 
 void IRGenerator::buildSSA() {
@@ -252,4 +239,3 @@ void IRGenerator::buildSSA() {
     }
 }
 
-
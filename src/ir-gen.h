@@ -12,71 +12,47 @@
 ;
 namespace kcc {
     class DirectCodeGen;
-    class IRGenerator : public Visitor {
+    class IRGenerator : public NodeVisitor<IRGenerator> {
         std::vector<Function> funcs;
+        std::vector<BinaryExpression *> chain; // left operands being walked, see visit(BinaryExpression *)
 
+        void emitBinaryExpression(BinaryExpression *expression);
 
-    public:
-
-        void visit(For *aFor) override;
-
-        void visit(Identifier *identifier) override;
-
-        void visit(While *aWhile) override;
-
-        void visit(Block *block) override;
-
-        void visit(TopLevel *level) override;
-
-        void visit(If *anIf) override;
-
-        void visit(TernaryExpression *expression) override;
-
-        void visit(Number *number) override;
-
-        void visit(Return *aReturn) override;
+        // reports an operator that has no opcode, nothing is emitted for it
+        void unsupported(BinaryExpression *expression);
 
-        void visit(Empty *empty) override;
-
-        void visit(PrimitiveType *type) override;
-
-        void visit(PointerType *type) override;
-
-        void visit(ArrayType *type) override;
-
-        void visit(ArgumentExepressionList *list) override;
-
-        void visit(FuncDefArg *arg) override;
+    public:
+        int errors; // operators with no opcode yet, reported so far
 
-        void visit(FuncDef *def) override;
+        IRGenerator() : errors(0) {}
 
-        void visit(CallExpression *expression) override;
+        using NodeVisitor<IRGenerator>::visit;
 
-        void visit(CastExpression *expression) override;
+        void visit(Identifier *identifier);
 
-        void visit(IndexExpression *expression) override;
+        void visit(While *aWhile);
 
-        void visit(Declaration *declaration) override;
+        void visit(Block *block);
 
-        void visit(DeclarationList *list) override;
+        void visit(TopLevel *level);
 
-        void visit(Literal *literal) override;
+        void visit(If *anIf);
 
-        void visit(BinaryExpression *expression) override;
+        void visit(Number *number);
 
-        void visit(UnaryExpression *expression) override;
+        void visit(Return *aReturn);
 
-        void pre(AST *ast) override;
+        void visit(ArgumentExepressionList *list);
 
-        void visit(Enum *anEnum) override;
+        void visit(FuncDef *def);
 
-        void visit(FuncType *type) override;
+        void visit(CallExpression *expression);
 
-        void visit(PostfixExpr *expr) override;
+        void visit(Literal *literal);
 
-        void visit(FuncArgType *type) override;
+        void visit(BinaryExpression *expression);
 
-        ~IRGenerator() override = default;
+        ~IRGenerator() = default;
 
         std::vector<IRNode> &ir() { return funcs.back().ir; }
 
@@ -94,18 +70,15 @@ namespace kcc {
         void patch(int idx, Opcode op) {
             ir()[idx] = (IRNode(op));
         }
-        void printIR() {
-            int cnt = 0;
-            for (auto i: ir()) {
-                println("{}: {}", cnt, i.dump());
-                cnt++;
-            }
-        }
+        // the last function, one numbered node per line
+        void printIR(Writer &out) const;
+
+        // every function, each after its name
+        void dumpIR(Writer &out) const;
 
         void buildSSA();
     };
 
-
 }
 
 #endif //KCC_IR_GEN_H
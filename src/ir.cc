@@ -7,85 +7,132 @@
 
 using namespace kcc;
 
-std::string kcc::IRNode::dump() const {
+void kcc::IRNode::dump(Writer &out) const {
     switch (op) {
         case Opcode::func_begin:
-            return format("FUNC: {},{}", s, a);
+            out.print("FUNC: {},{}", s, a);
+            break;
         case Opcode::func_end:
-            return std::string("END");
+            out.write("END");
+            break;
         case Opcode::iconst:
-            return format("t{} = ${}", a, b);
+            out.print("t{} = ${}", a, b);
+            break;
         case Opcode::fconst:
-            return format("t{} = ${}", a, b.fImm);
+            out.print("t{} = ${}", a, b.fImm);
+            break;
         case Opcode::sconst:
-            return format("t{} = \"{}\"", a, s);
+            out.print("t{} = \"{}\"", a, escapeString(s));
+            break;
         case Opcode::cvtf2i:
-            return format("t{} = (int)t{}", a, b);
+            out.print("t{} = (int)t{}", a, b);
+            break;
         case Opcode::cvti2f:
-            return format("t{} = (double)t{}", a, b);
+            out.print("t{} = (double)t{}", a, b);
+            break;
         case Opcode::iadd:
-            return format("t{} = t{} + t{}", a, b, c);
+            out.print("t{} = t{} + t{}", a, b, c);
+            break;
         case Opcode::isub:
-            return format("t{} = t{} - t{}", a, b, c);
+            out.print("t{} = t{} - t{}", a, b, c);
+            break;
         case Opcode::imul:
-            return format("t{} = t{} * t{}", a, b, c);
+            out.print("t{} = t{} * t{}", a, b, c);
+            break;
         case Opcode::idiv:
-            return format("t{} = t{} / t{}", a, b, c);
+            out.print("t{} = t{} / t{}", a, b, c);
+            break;
         case Opcode::il:
-            return format("t{} = t{} < t{}", a, b, c);
+            out.print("t{} = t{} < t{}", a, b, c);
+            break;
         case Opcode::ile:
-            return format("t{} = t{} <= t{}", a, b, c);
+            out.print("t{} = t{} <= t{}", a, b, c);
+            break;
         case Opcode::ig:
-            return format("t{} = t{} > t{}", a, b, c);
+            out.print("t{} = t{} > t{}", a, b, c);
+            break;
         case Opcode::ige:
-            return format("t{} = t{} >= t{}", a, b, c);
+            out.print("t{} = t{} >= t{}", a, b, c);
+            break;
         case Opcode::ie:
-            return format("t{} = t{} == t{}", a, b, c);
+            out.print("t{} = t{} == t{}", a, b, c);
+            break;
         case Opcode::ine:
-            return format("t{} = t{} != t{}", a, b, c);
+            out.print("t{} = t{} != t{}", a, b, c);
+            break;
         case Opcode::fadd:
-            return format("t{} = t{} +. t{}", a, b, c);
+            out.print("t{} = t{} +. t{}", a, b, c);
+            break;
         case Opcode::fsub:
-            return format("t{} = t{} -. t{}", a, b, c);
+            out.print("t{} = t{} -. t{}", a, b, c);
+            break;
         case Opcode::fmul:
-            return format("t{} = t{} *. t{}", a, b, c);
+            out.print("t{} = t{} *. t{}", a, b, c);
+            break;
         case Opcode::fdiv:
-            return format("t{} = t{} /. t{}", a, b, c);
+            out.print("t{} = t{} /. t{}", a, b, c);
+            break;
         case Opcode::fl:
-            return format("t{} = t{} <. t{}", a, b, c);
+            out.print("t{} = t{} <. t{}", a, b, c);
+            break;
         case Opcode::fle:
-            return format("t{} = t{} <=. t{}", a, b, c);
+            out.print("t{} = t{} <=. t{}", a, b, c);
+            break;
         case Opcode::fg:
-            return format("t{} = t{} >. t{}", a, b, c);
+            out.print("t{} = t{} >. t{}", a, b, c);
+            break;
         case Opcode::fge:
-            return format("t{} = t{} >=. t{}", a, b, c);
+            out.print("t{} = t{} >=. t{}", a, b, c);
+            break;
         case Opcode::fe:
-            return format("t{} = t{} ==. t{}", a, b, c);
+            out.print("t{} = t{} ==. t{}", a, b, c);
+            break;
         case Opcode::fne:
-            return format("t{} = t{} !=. t{}", a, b, c);
+            out.print("t{} = t{} !=. t{}", a, b, c);
+            break;
         case Opcode::jmp:
-            return format("jmp {}", a);
+            out.print("jmp {}", a);
+            break;
         case Opcode::branch:
-            return format("branch t{}, %true. {}, %false. {}", a, b, c);
+            out.print("branch t{}, %true. {}, %false. {}", a, b, c);
+            break;
         case Opcode::load:
-            return format("t{} = [{}]_{}", a, b, version);
+            out.print("t{} = [{}]_{}", a, b, version);
+            break;
         case Opcode::store:
-            return format("[{}]_{} = t{}", a, version, b);
+            out.print("[{}]_{} = t{}", a, version, b);
+            break;
         case Opcode::empty:
-            return std::string("end");
+            out.write("end");
+            break;
         case Opcode::ret:
-            return format("ret t{}", a);
+            out.print("ret t{}", a);
+            break;
         case Opcode::pushi:
-            return format("pushi t{}", a);
+            out.print("pushi t{}", a);
+            break;
         case Opcode::pushf:
-            return format("pushf t{}", a);
+            out.print("pushf t{}", a);
+            break;
         case Opcode::callGlobal:
-            return format("call global {}", s);
+            out.print("call global {}", s);
+            break;
         default:
-            return format("unknown opcode {}", (int) op);
+            out.print("unknown opcode {}", (int) op);
+            break;
+    }
+}
+
+std::string kcc::IRNode::dump() const {
+    std::string s;
+    {
+        Writer out(s);
+        dump(out);
     }
+    return s;
 }
 
+
 void Function::findEdges() {
     ir.emplace_back(IRNode(Opcode::empty));//to prevent segfaults :D
     for (int i = 0; i < ir.size(); i++) {
@@ -160,11 +207,19 @@ void Function::assignEdgeToBB() {
     }
 }
 
+void Phi::dump(Writer &out) const {
+    out.print("[{}]_{} = phi(", result.addr, result.ver);
+    for (auto &i:param) {
+        out.print("[{}]_{},", i.addr, i.ver);
+    }
+    out.put(')');
+}
+
 std::string Phi::dump() const {
-    std::string s = format("[{}]_{} = phi(", result.addr, result.ver);
-    for (auto i:param) {
-        s.append(format("[{}]_{},", i.addr, i.ver));
+    std::string s;
+    {
+        Writer out(s);
+        dump(out);
     }
-    s.append(")");
     return s;
 }
@@ -76,6 +76,8 @@ namespace kcc {
             }
         }
 
+        void dump(Writer &out) const;
+
         std::string dump() const;
     };
 
@@ -96,7 +98,7 @@ namespace kcc {
         Value a;
         Value b;
         Value c;
-        int version;
+        int version = 0; // set by renaming, see cfg.cc
         std::string s;
         BasicBlock *bb;
 
@@ -118,6 +120,8 @@ namespace kcc {
         std::vector<int> in;
         std::vector<int> out;
 
+        void dump(Writer &out) const;
+
         std::string dump() const;
 
         void erase() { op = Opcode::nop; }
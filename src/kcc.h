@@ -3,6 +3,7 @@
 #define KCC_H
 
 #include <list>
+#include <deque>
 #include <vector>
 #include <stack>
 #include <memory>
@@ -8,38 +8,30 @@
 
 #include "lex.h"
 #include "format.h"
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 using namespace kcc;
-Token::Token(Type t, const std::string to, int l, int c) {
+Token::Token(Type t, const std::string &to, uint32_t o) {
     type = t;
-    line = l;
-    col = c;
-    tok = to;
+    code = 0;
+    flags = 0;
+    offset = o;
     if (to.empty()) {
         throw std::runtime_error("token is empty");
     }
-}
-
-char Lexer::at(int idx) {
-    if (idx >= source.size())
-        return 0;
-    else
-        return source.at(idx);
+    sym = Interner::get().intern(to);
 }
 
 void Lexer::consume() {
     //putchar(cur());
-    if (cur() == '\n') {
-        line++;
-        col = 1;
-    } else {
-        if (cur() == '\t')
-            col += 4;
-        else
-            col++;
-    }
     pos++;
-    if (pos > source.length() + 10)
-        throw std::runtime_error("parser boom!");
 }
 
 char Lexer::cur() {
@@ -54,35 +46,122 @@ char Lexer::peek2() {
     return at(pos + 2);
 }
 
-bool isSpace(char c) {
-    return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+/* Whitespace and comments are skipped a chunk at a time.
+ * Every byte of a chunk is compared against the interesting characters and
+ * the results are packed into a bit mask, one bit per byte; the first
+ * stopping byte is then found with a bit scan.
+ * The source is NUL padded (see SourceFile), so loads never go out of bounds.
+ */
+namespace {
+#if defined(__AVX2__)
+    typedef __m256i Chunk;
+    const int chunkSize = 32;
+    const uint32_t chunkMask = ~0u;
+
+    inline Chunk load(const char *p) { return _mm256_loadu_si256((const __m256i *) p); }
+
+    inline uint32_t match(Chunk c, char ch) {
+        return (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(ch)));
+    }
+#elif defined(__SSE2__)
+    typedef __m128i Chunk;
+    const int chunkSize = 16;
+    const uint32_t chunkMask = 0xffffu;
+
+    inline Chunk load(const char *p) { return _mm_loadu_si128((const __m128i *) p); }
+
+    inline uint32_t match(Chunk c, char ch) {
+        return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(ch)));
+    }
+#else
+    // scalar fallback, a chunk is a single byte
+    typedef char Chunk;
+    const int chunkSize = 1;
+    const uint32_t chunkMask = 1u;
+
+    inline Chunk load(const char *p) { return *p; }
+
+    inline uint32_t match(Chunk c, char ch) { return c == ch; }
+#endif
+
+    inline int firstBit(uint32_t mask) { return __builtin_ctz(mask); }
 }
 
-void Lexer::skipspace() {
-    skipcomment();
-    while (isSpace(cur())) {
-        consume();
-        skipcomment();
+bool Lexer::skipspace() {
+    bool newline = false;
+    while (true) {
+        int from = pos;
+        skipwhitespace();
+        if (!newline && memchr(source + from, '\n', pos - from))
+            newline = true;
+        int i = isComment();
+        if (!i) {
+            // a backslash-newline joins two lines
+            if (cur() == '\\' && (peek() == '\n' || (peek() == '\r' && peek2() == '\n'))) {
+                pos += peek() == '\n' ? 2 : 3;
+                continue;
+            }
+            return newline;
+        }
+        if (i == 3)
+            skipblockcomment();
+        else
+            skiplinecomment();
     }
 }
 
-void Lexer::skipcomment() {
-    int i = isComment();
-    if (!i)
-        return;
-    if (i == 1 || i == 2) {
-        while (cur() != '\n')
-            consume();
-    } else if (i == 3) {
-        while (!(cur() == '*' && peek() == '/'))
-            consume();
-        consume();
-        consume();
+void Lexer::skipwhitespace() {
+    while (true) {
+        auto c = load(source + pos);
+        auto space = match(c, ' ') | match(c, '\t') | match(c, '\r') | match(c, '\n')
+                     | match(c, '\f') | match(c, '\v');
+        auto rest = ~space & chunkMask;
+        if (rest) {
+            pos += firstBit(rest);
+            return;
+        }
+        pos += chunkSize;
+    }
+}
+
+// stops at the terminating newline or at the end of input
+void Lexer::skiplinecomment() {
+    while (true) {
+        auto c = load(source + pos);
+        auto stop = match(c, '\n') | match(c, 0);
+        if (stop) {
+            pos += firstBit(stop);
+            if (cur() == '\n' || pos >= length)
+                return;
+            pos++; // a NUL inside the file
+        } else {
+            pos += chunkSize;
+        }
+    }
+}
+
+void Lexer::skipblockcomment() {
+    pos += 2;
+    while (true) {
+        auto c = load(source + pos);
+        auto stop = (match(c, '*') & match(load(source + pos + 1), '/')) | match(c, 0);
+        if (stop) {
+            pos += firstBit(stop);
+            if (cur() == '*') {
+                pos += 2;
+                return;
+            }
+            if (pos >= length)
+                throw std::runtime_error("unterminated comment");
+            pos++; // a NUL inside the comment
+        } else {
+            pos += chunkSize;
+        }
     }
 }
 
 int Lexer::isComment() {
-    if (cur() == '#') // skip preprocessor instructions
+    if (cur() == '#' && !raw) // without a Preprocessor directives are skipped
         return 1;
     if (cur() == '/' && peek() == '/') {
         return 2;
@@ -93,13 +172,37 @@ int Lexer::isComment() {
     return 0;
 }
 
-Lexer::Lexer(const char * _filename,const std::string &s) {
-    filename = _filename;
+Lexer::Lexer(const SourceFile &file, bool _raw) {
     pos = 0;
-    source = s;
-    line = 1;
-    col = 1;
+    served = 0;
+    raw = _raw;
+    atLineStart = true;
+    base = file.offset();
+    source = file.begin();
+    length = (int) file.size();
+    strings = &Interner::get();
+}
 
+Lexer::Lexer(const Lexer &parent, int begin, int end, Interner *_strings) {
+    pos = begin;
+    served = 0;
+    raw = parent.raw;
+    atLineStart = true; // chunks start at line starts
+    base = parent.base;
+    source = parent.source;
+    length = end;
+    strings = _strings;
+}
+
+Lexer::Lexer(const SourceFile &file, uint32_t begin, uint32_t end, bool _raw) {
+    base = file.offset();
+    pos = (int) (begin - base);
+    served = 0;
+    raw = _raw;
+    atLineStart = true;
+    source = file.begin();
+    length = (int) (end - base);
+    strings = &Interner::get();
 }
 
 bool isDigit(char c) {
@@ -110,199 +213,826 @@ bool isIden(char c) {
     return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
 }
 
-static std::set<std::string> keywords =
-        {"auto", "break", "case", "char",
-         "const", "continue", "default", "do", "double", "else", "enum",
-         "extern", "float", "for", "goto", "if", "inline", "int", "long",
-         "register", "restrict", "return", "short", "signed", "short", "signed",
-         "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned",
-         "void", "volatile", "while", "_Alignas", "_Alignof", "_Atomic", "_Bool",
-         "_Complex", "_Generic", "_Imaginary", "_Noreturn", "_Static_assert",
-         "_Thread_local"};
-static std::vector<std::set<std::string>> operators =
-        {{"&&=", "||=", ">>=", "<<="},
-         {"&&","||","++","--","+=",  "-=",  "*=",  "/=", "%=", "|=", "&=", "^=", ">=", "<=", "!=", "==", "->", ">>", "<<"},
-         {"+",   "-",   "*",   "/",  "%",  "&",  "|",  "^",  "(",  ")",  "[",  "]",  "{",  "}",  ",", "=", "\\", "<", ">", ".", ":",
-                 "?", "~", "!"}};
-static std::set<char> opChar =
-        {'+', '-', '*', '/', '%', '^', '>', '<', '!',
-         '=', '(', ')', '[', ']', '{', '}', '.', ':', ',', '\\', '&', '|', '~',
-         '?'};
+const char *kcc::keywordSpelling(Keyword kw) {
+    static const char *spellings[] = {
+            "",
+#define KCC_KEYWORD_SPELLING(name, spelling) spelling,
+            KCC_KEYWORDS(KCC_KEYWORD_SPELLING)
+#undef KCC_KEYWORD_SPELLING
+    };
+    return spellings[(int) kw];
+}
+
+const char *kcc::punctuatorSpelling(Punct p) {
+    static const char *spellings[] = {
+            "",
+#define KCC_PUNCTUATOR_SPELLING(name, spelling) spelling,
+            KCC_PUNCTUATORS(KCC_PUNCTUATOR_SPELLING)
+#undef KCC_PUNCTUATOR_SPELLING
+    };
+    return spellings[(int) p];
+}
+
+static Symbol punctuatorSymbol(Punct p) {
+    static std::vector<Symbol> symbols;
+    if (symbols.empty()) {
+        symbols.emplace_back(0);
+#define KCC_PUNCTUATOR_SYMBOL(name, spelling) symbols.emplace_back(Interner::get().intern(spelling));
+        KCC_PUNCTUATORS(KCC_PUNCTUATOR_SYMBOL)
+#undef KCC_PUNCTUATOR_SYMBOL
+    }
+    return symbols[(int) p];
+}
+
+Token::Token(Punct p, uint32_t o) {
+    type = Type::Punctuator;
+    code = (unsigned char) p;
+    flags = 0;
+    sym = punctuatorSymbol(p);
+    offset = o;
+}
+
+// a DFA over at most three bytes, dispatched on the first one
+Punct kcc::matchPunctuator(const char *s, int &len) {
+#define ONE(p) do { len = 1; return Punct::p; } while (0)
+#define TWO(c, p) do { if (s[1] == (c)) { len = 2; return Punct::p; } } while (0)
+#define THREE(c1, c2, p) do { if (s[1] == (c1) && s[2] == (c2)) { len = 3; return Punct::p; } } while (0)
+    switch (s[0]) {
+        case '+':
+            TWO('+', PlusPlus);
+            TWO('=', PlusAssign);
+            ONE(Plus);
+        case '-':
+            TWO('-', MinusMinus);
+            TWO('=', MinusAssign);
+            TWO('>', Arrow);
+            ONE(Minus);
+        case '*':
+            TWO('=', StarAssign);
+            ONE(Star);
+        case '/':
+            TWO('=', SlashAssign);
+            ONE(Slash);
+        case '%':
+            TWO('=', PercentAssign);
+            ONE(Percent);
+        case '^':
+            TWO('=', CaretAssign);
+            ONE(Caret);
+        case '&':
+            THREE('&', '=', AndAndAssign);
+            TWO('&', AndAnd);
+            TWO('=', AmpAssign);
+            ONE(Amp);
+        case '|':
+            THREE('|', '=', OrOrAssign);
+            TWO('|', OrOr);
+            TWO('=', PipeAssign);
+            ONE(Pipe);
+        case '>':
+            THREE('>', '=', ShiftRightAssign);
+            TWO('>', ShiftRight);
+            TWO('=', GreaterEqual);
+            ONE(Greater);
+        case '<':
+            THREE('<', '=', ShiftLeftAssign);
+            TWO('<', ShiftLeft);
+            TWO('=', LessEqual);
+            ONE(Less);
+        case '!':
+            TWO('=', NotEqual);
+            ONE(Not);
+        case '=':
+            TWO('=', Equal);
+            ONE(Assign);
+        case '(':
+            ONE(LParen);
+        case ')':
+            ONE(RParen);
+        case '[':
+            ONE(LBracket);
+        case ']':
+            ONE(RBracket);
+        case '{':
+            ONE(LBrace);
+        case '}':
+            ONE(RBrace);
+        case ',':
+            ONE(Comma);
+        case '\\':
+            ONE(Backslash);
+        case '.':
+            THREE('.', '.', Ellipsis);
+            ONE(Dot);
+        case '#':
+            TWO('#', HashHash);
+            ONE(Hash);
+        case ':':
+            ONE(Colon);
+        case '?':
+            ONE(Question);
+        case '~':
+            ONE(Tilde);
+        default:
+            len = 0;
+            return Punct::None;
+    }
+#undef ONE
+#undef TWO
+#undef THREE
+}
 
 Token Lexer::next() {
     if (cur() == ';') {
         consume();
-        return makeToken(Token::Type::Terminator, ";", line, col);
-    } else if (isdigit(cur())) { // numbers
+        return makeToken(Token::Type::Terminator, pos - 1);
+    } else if (isdigit(cur()) || (cur() == '.' && isdigit(peek()))) { // numbers
         return number();
     } else if (isIden(cur())) {
+        // wide and unicode literals are lexed like plain ones
+        int prefix = cur() == 'u' && peek() == '8' ? 2 : (cur() == 'L' || cur() == 'u' || cur() == 'U' ? 1 : 0);
+        if (prefix && (at(pos + prefix) == '"' || at(pos + prefix) == '\'')) {
+            pos += prefix;
+            return string();
+        }
         return identifier();
-    } else if (opChar.find(cur()) != opChar.end()) {
-        return punctuator();
     } else if (cur() == '\"' || cur() == '\'') {
         return string();
+    } else {
+        return punctuator();
     }
-    throw std::runtime_error(std::string("unable to parse ") + cur());
+}
+
+// adjacent string literals become one token
+static Symbol concatenate(Interner &strings, Symbol a, Symbol b) {
+    return strings.intern(strings.str(a) + strings.str(b));
 }
 
 void Lexer::scan() {
-    try {
-        skipspace();
-        while (pos < source.length()) {
-            auto tok = next();
-            if(tokenStream.size() > 0) {
-                auto last = tokenStream.back();
-                if (last.type == tok.type && tok.type == Token::Type::String) {
-                    auto s = last.tok;
-                    s.pop_back();
-                    auto s2 = tok.tok;
-                    for (auto iter = s2.begin() + 1; iter != s2.end(); iter++) {
-                        s += *iter;
-                    }
-                    last.tok = s;
-                    tokenStream.pop_back();
-                    tokenStream.push_back(last);
-                    skipspace();
-                    continue;
-                }
+    for (auto tok = lex(); tok.type != Token::Type::Nil; tok = lex()) {
+        tokenStream.push_back(tok);
+    }
+}
+
+/* Line starts that are safe to split at, roughly length / chunks apart.
+ * Follows just enough of the lexer to know whether a newline is inside a
+ * block comment or a literal.
+ */
+static std::vector<int> splitPoints(const char *s, int length, int chunks) {
+    std::vector<int> points = {0};
+    int step = length / chunks;
+    int i = 0;
+    while (i < length && (int) points.size() < chunks) {
+        char c = s[i];
+        if (c == '\n') {
+            bool continued = i > 0 && (s[i - 1] == '\\' || (s[i - 1] == '\r' && i > 1 && s[i - 2] == '\\'));
+            if (!continued && i + 1 - points.back() >= step && i + 1 < length)
+                points.push_back(i + 1);
+            i++;
+        } else if (c == '#' || (c == '/' && s[i + 1] == '/')) {
+            auto p = (const char *) memchr(s + i, '\n', length - i);
+            i = p ? (int) (p - s) : length;
+        } else if (c == '/' && s[i + 1] == '*') {
+            i += 2;
+            while (i < length && !(s[i] == '*' && s[i + 1] == '/'))
+                i++;
+            i += 2;
+        } else if (c == '"' || c == '\'') {
+            i++;
+            while (i < length && s[i] != c) {
+                if (s[i] == '\\')
+                    i++;
+                i++;
             }
-             tokenStream.push_back(tok);
+            i++;
+        } else {
+            i++;
+        }
+    }
+    points.push_back(length);
+    return points;
+}
+
+void Lexer::scanParallel(int threads) {
+    const int minChunk = 256 * 1024;
+    int chunks = std::min(threads, (length - pos) / minChunk);
+    if (chunks <= 1 || pos != 0) {
+        scan();
+        return;
+    }
+    auto points = splitPoints(source, length, chunks);
+    auto n = points.size() - 1;
+    // workers share the punctuator symbols, make sure they exist beforehand
+    punctuatorSymbol(Punct::Plus);
+    std::vector<std::vector<Token>> results(n);
+    std::vector<std::unique_ptr<Interner>> interners(n);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < n; i++) {
+        interners[i].reset(new Interner());
+        workers.emplace_back([&, i]() {
+            Lexer lex(*this, points[i], points[i + 1], interners[i].get());
+            lex.scan();
+            results[i].swap(lex.tokenStream);
+        });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+    for (size_t i = 0; i < n; i++) {
+        auto &local = *interners[i];
+        std::vector<Symbol> remap(local.size(), 0);
+        for (Symbol sym = 1; sym < local.size(); sym++) {
+            remap[sym] = strings->intern(local.str(sym));
+            strings->setValue(remap[sym], local.value(sym));
+        }
+        bool first = true;
+        for (auto t : results[i]) {
+            if (t.type != Token::Type::Punctuator)
+                t.sym = remap[t.sym];
+            // a string literal split across the seam
+            if (first && !raw && !tokenStream.empty() && t.type == Token::Type::String
+                && tokenStream.back().type == Token::Type::String) {
+                tokenStream.back().sym = concatenate(*strings, tokenStream.back().sym, t.sym);
+            } else {
+                tokenStream.push_back(t);
+            }
+            first = false;
+        }
+    }
+    pos = length;
+}
+
+// true if [begin, end) ends a line, backslash-newlines do not count
+bool Lexer::crossesNewline(int begin, int end) {
+    const char *e = source + end;
+    for (auto p = source + begin; p < e; p++) {
+        p = (const char *) memchr(p, '\n', e - p);
+        if (!p)
+            return false;
+        auto q = p > source && p[-1] == '\r' ? p - 1 : p;
+        if (q == source || q[-1] != '\\')
+            return true;
+    }
+    return false;
+}
+
+bool Lexer::skipGroup() {
+    int depth = 0;
+    bool lineStart = true; // the group starts after the line of its directive
+    while (true) {
+        if (lineStart) {
             skipspace();
+            if (pos >= length)
+                break;
+            if (cur() == '#') {
+                int hash = pos;
+                pos++;
+                while (cur() == ' ' || cur() == '\t' || (cur() == '/' && peek() == '*')) {
+                    if (cur() == '/')
+                        skipblockcomment();
+                    else
+                        pos++;
+                }
+                int begin = pos;
+                while (isIden(cur()) || isDigit(cur()))
+                    pos++;
+                auto name = std::string(source + begin, pos - begin);
+                if (name == "if" || name == "ifdef" || name == "ifndef") {
+                    depth++;
+                } else if (depth > 0 && name == "endif") {
+                    depth--;
+                } else if (depth == 0 && (name == "elif" || name == "else" || name == "endif")) {
+                    pos = hash;
+                    atLineStart = true;
+                    return true;
+                }
+            }
+            lineStart = false;
+        }
+        // only newlines, comments and literals matter in the rest of a line
+        auto c = load(source + pos);
+        auto stop = match(c, '\n') | match(c, '/') | match(c, '"') | match(c, '\'') | match(c, 0);
+        if (!stop) {
+            pos += chunkSize;
+            continue;
+        }
+        pos += firstBit(stop);
+        if (pos >= length)
+            break;
+        char ch = cur();
+        if (ch == '\n') {
+            // a backslash-newline does not start a line
+            lineStart = crossesNewline(pos, pos + 1);
+            pos++;
+        } else if (ch == '/' && peek() == '/') {
+            skiplinecomment();
+        } else if (ch == '/' && peek() == '*') {
+            skipblockcomment(); // stands for a space, even when it spans lines
+        } else if (ch == '"' || ch == '\'') {
+            // an unterminated quote ends with its line, as in raw lexing
+            pos++;
+            while (pos < length && cur() != ch && cur() != '\n') {
+                if (cur() == '\\' && peek() != 0)
+                    pos += peek() == '\r' && peek2() == '\n' ? 2 : 1;
+                pos++;
+            }
+            if (cur() == ch)
+                pos++;
+        } else {
+            pos++; // '/' alone or a NUL inside the file
+        }
+    }
+    pos = length;
+    return false;
+}
+
+Token Lexer::get() {
+    if (served < tokenStream.size())
+        return tokenStream[served++];
+    return lex();
+}
+
+Token Lexer::lex() {
+    try {
+        int begin = pos;
+        bool newline = skipspace();
+        if (pos >= length)
+            return Token();
+        int start = pos;
+        auto t = next();
+        if (raw) {
+            if (atLineStart || newline)
+                t.flags |= Token::StartOfLine;
+            if (start > begin)
+                t.flags |= Token::LeadingSpace;
+            atLineStart = false;
         }
+        return t;
     } catch (std::runtime_error &e) {
-        std::cerr << e.what() << std::endl;
+        auto p = SourceManager::get().getPos(base + std::min(pos, length));
+        fprintln(stderr, "{}:{}:{}:error: {}", p.filename, p.line, p.col, e.what());
+        pos = length;
+        return Token();
     }
 }
 
-bool Lexer::isKeyWord(const std::string &s) {
-    return keywords.find(s) != keywords.end();
+// dispatch on length and first character, then confirm with one memcmp
+Keyword Lexer::matchKeyword(const char *s, int len) {
+#define KEYWORD(spelling, name) if (memcmp(s, spelling, len) == 0) return Keyword::name
+    switch (len) {
+        case 2:
+            switch (s[0]) {
+                case 'd':
+                    KEYWORD("do", Do);
+                    break;
+                case 'i':
+                    KEYWORD("if", If);
+                    break;
+            }
+            break;
+        case 3:
+            switch (s[0]) {
+                case 'f':
+                    KEYWORD("for", For);
+                    break;
+                case 'i':
+                    KEYWORD("int", Int);
+                    break;
+            }
+            break;
+        case 4:
+            switch (s[0]) {
+                case 'a':
+                    KEYWORD("auto", Auto);
+                    break;
+                case 'c':
+                    KEYWORD("case", Case);
+                    KEYWORD("char", Char);
+                    break;
+                case 'e':
+                    KEYWORD("else", Else);
+                    KEYWORD("enum", Enum);
+                    break;
+                case 'g':
+                    KEYWORD("goto", Goto);
+                    break;
+                case 'l':
+                    KEYWORD("long", Long);
+                    break;
+                case 'v':
+                    KEYWORD("void", Void);
+                    break;
+            }
+            break;
+        case 5:
+            switch (s[0]) {
+                case '_':
+                    KEYWORD("_Bool", Bool);
+                    break;
+                case 'b':
+                    KEYWORD("break", Break);
+                    break;
+                case 'c':
+                    KEYWORD("const", Const);
+                    break;
+                case 'f':
+                    KEYWORD("float", Float);
+                    break;
+                case 's':
+                    KEYWORD("short", Short);
+                    break;
+                case 'u':
+                    KEYWORD("union", Union);
+                    break;
+                case 'w':
+                    KEYWORD("while", While);
+                    break;
+            }
+            break;
+        case 6:
+            switch (s[0]) {
+                case 'd':
+                    KEYWORD("double", Double);
+                    break;
+                case 'e':
+                    KEYWORD("extern", Extern);
+                    break;
+                case 'i':
+                    KEYWORD("inline", Inline);
+                    break;
+                case 'r':
+                    KEYWORD("return", Return);
+                    break;
+                case 's':
+                    KEYWORD("signed", Signed);
+                    KEYWORD("sizeof", Sizeof);
+                    KEYWORD("static", Static);
+                    KEYWORD("struct", Struct);
+                    KEYWORD("switch", Switch);
+                    break;
+            }
+            break;
+        case 7:
+            switch (s[0]) {
+                case '_':
+                    KEYWORD("_Atomic", Atomic);
+                    break;
+                case 'd':
+                    KEYWORD("default", Default);
+                    break;
+                case 't':
+                    KEYWORD("typedef", Typedef);
+                    break;
+            }
+            break;
+        case 8:
+            switch (s[0]) {
+                case '_':
+                    KEYWORD("_Alignas", Alignas);
+                    KEYWORD("_Alignof", Alignof);
+                    KEYWORD("_Complex", Complex);
+                    KEYWORD("_Generic", Generic);
+                    break;
+                case 'c':
+                    KEYWORD("continue", Continue);
+                    break;
+                case 'r':
+                    KEYWORD("register", Register);
+                    KEYWORD("restrict", Restrict);
+                    break;
+                case 'u':
+                    KEYWORD("unsigned", Unsigned);
+                    break;
+                case 'v':
+                    KEYWORD("volatile", Volatile);
+                    break;
+            }
+            break;
+        case 9:
+            switch (s[0]) {
+                case '_':
+                    KEYWORD("_Noreturn", Noreturn);
+                    break;
+            }
+            break;
+        case 10:
+            switch (s[0]) {
+                case '_':
+                    KEYWORD("_Imaginary", Imaginary);
+                    break;
+            }
+            break;
+        case 13:
+            switch (s[0]) {
+                case '_':
+                    KEYWORD("_Thread_local", ThreadLocal);
+                    break;
+            }
+            break;
+        case 14:
+            switch (s[0]) {
+                case '_':
+                    KEYWORD("_Static_assert", StaticAssert);
+                    break;
+            }
+            break;
+    }
+#undef KEYWORD
+    return Keyword::None;
 }
 
 Token Lexer::identifier() {
-    std::string iden;
+    int begin = pos;
     while (isIden(cur()) || isdigit(cur())) {
-        iden += cur();
         consume();
     }
-    if (isKeyWord(iden))
-        return makeToken(Token::Type::Keyword, iden, line, col);
-    else
-        return makeToken(Token::Type::Identifier, iden, line, col);
+    auto t = makeToken(Token::Type::Identifier, begin);
+    auto kw = matchKeyword(source + begin, pos - begin);
+    if (kw != Keyword::None) {
+        t.type = Token::Type::Keyword;
+        t.code = (unsigned char) kw;
+    }
+    return t;
+}
+
+static int digitValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return 16;
+}
+
+/* Decimal floating literal to double.
+ * Exact when the significand fits in 53 bits and the power of ten
+ * is exactly representable (Clinger's fast path), strtod otherwise.
+ */
+static double parseFloat(const char *s, int len) {
+    static const double powers[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+            1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    uint64_t mantissa = 0;
+    int digits = 0, exp10 = 0, i = 0;
+    bool truncated = false;
+    for (bool fraction = false; i < len; i++) {
+        if (s[i] == '.') {
+            fraction = true;
+            continue;
+        }
+        if (!isdigit(s[i]))
+            break;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (s[i] - '0');
+            if (mantissa)
+                digits++;
+            if (fraction)
+                exp10--;
+        } else {
+            truncated |= s[i] != '0';
+            if (!fraction)
+                exp10++;
+        }
+    }
+    if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+        i++;
+        bool negative = s[i] == '-';
+        if (s[i] == '-' || s[i] == '+')
+            i++;
+        int e = 0;
+        for (; i < len && isdigit(s[i]); i++)
+            e = std::min(e * 10 + (s[i] - '0'), 100000);
+        exp10 += negative ? -e : e;
+    }
+    if (!truncated && mantissa <= (1ull << 53) && exp10 >= -22 && exp10 <= 22) {
+        double d = (double) mantissa;
+        return exp10 < 0 ? d / powers[-exp10] : d * powers[exp10];
+    }
+    return strtod(std::string(s, len).c_str(), nullptr);
 }
 
 Token Lexer::number() {
-    std::string number;
-    Token::Type ty =  Token::Type::Int;
-    if (cur() == '0' && peek() == 'x') {
-        number += cur();
-        number += peek();
+    int begin = pos;
+    Token::Type ty = Token::Type::Int;
+    uint64_t value = 0;
+    bool overflow = false;
+    auto accumulate = [&](int base) {
+        uint64_t digit = digitValue(cur());
+        if (value > (UINT64_MAX - digit) / base)
+            overflow = true;
+        value = value * base + digit;
         consume();
+    };
+    if (cur() == '0' && (peek() == 'x' || peek() == 'X')) {
         consume();
-        while (isdigit(cur()) || (cur() >= 'A' && cur() <= 'F')
-               || (cur() >= 'a' && cur() <= 'f')) {
-            number += cur();
-            consume();
-        }
-    } else if (cur() == '0' && peek() != 'x' && peek() != '.') {
-        while (cur() >= '0' && cur() <= '7') {
-            number += cur();
-            consume();
-        }
+        consume();
+        while (isxdigit(cur()))
+            accumulate(16);
+    } else if (cur() == '0' && isdigit(peek())) {
+        while (cur() >= '0' && cur() <= '7')
+            accumulate(8);
     } else {
-        while (isdigit(cur())) {
-            number += cur();
-            consume();
-        }
+        while (isdigit(cur()))
+            accumulate(10);
         if (cur() == '.') {
-            ty =  Token::Type::Float;
-            number += cur();
+            ty = Token::Type::Float;
             consume();
             while (isdigit(cur())) {
-                number += cur();
                 consume();
             }
         }
-        if (cur() == 'e') {
-            ty =  Token::Type::Float;
-            number += cur();
-            if (peek() == '-') {
+        if (cur() == 'e' || cur() == 'E') {
+            ty = Token::Type::Float;
+            consume();
+            if (cur() == '-' || cur() == '+') {
                 consume();
-                number += cur();
             }
-            consume();
             while (isdigit(cur())) {
-                number += cur();
                 consume();
             }
         }
-        if(cur() == 'f'){
-            ty =  Token::Type::Float;
-            number += cur();
+        if (cur() == 'f' || cur() == 'F') {
+            ty = Token::Type::Float;
+        }
+    }
+    int end = pos;
+    unsigned char suffix = 0;
+    if (ty == Token::Type::Float) {
+        if (cur() == 'f' || cur() == 'F') {
+            suffix = Token::FloatSuffix;
+            consume();
+        } else if (cur() == 'l' || cur() == 'L') {
+            suffix = Token::Long;
             consume();
         }
+        double d = parseFloat(source + begin, end - begin);
+        memcpy(&value, &d, sizeof(value));
+    } else {
+        if (overflow)
+            throw std::runtime_error("integer literal is too large");
+        while (true) {
+            if ((cur() == 'u' || cur() == 'U') && !(suffix & Token::Unsigned)) {
+                suffix |= Token::Unsigned;
+                consume();
+            } else if ((cur() == 'l' || cur() == 'L') && !(suffix & (Token::Long | Token::LongLong))) {
+                if (peek() == cur()) {
+                    suffix |= Token::LongLong;
+                    consume();
+                } else {
+                    suffix |= Token::Long;
+                }
+                consume();
+            } else {
+                break;
+            }
+        }
     }
-    return makeToken(ty, number, line, col);
+    auto t = makeToken(ty, begin);
+    t.code = suffix;
+    strings->setValue(t.sym, value);
+    return t;
 }
 
 Token Lexer::punctuator() {
-    char p2 = peek2();
-    char p = peek();
-    std::string s1, s2, s3;
-    s1 = cur();
-    s2 = s1 + p;
-    s3 = s2 + p2;
-    //std::cout << s1 << " " << s2 << " " << s3 << " " << std::endl;
-    //system("pause");
-    if (operators[0].find(s3) != operators[0].end()) {
-        auto t = makeToken(Token::Type::Punctuator, s3, line, col);
-        consume();
-        consume();
-        consume();
-        return t;
-    } else if (operators[1].find(s2) != operators[1].end()) {
-        auto t = makeToken(Token::Type::Punctuator, s2, line, col);
-        consume();
-        consume();
-        return t;
-    } else if (operators[2].find(s1) != operators[2].end()) {
-        auto t = makeToken(Token::Type::Punctuator, s1, line, col);
-        consume();
-        return t;
-    } else {
-        throw std::runtime_error(std::string("unable to parse ") + cur());
+    int len;
+    auto p = matchPunctuator(source + pos, len);
+    if (p == Punct::None && raw) {
+        // a stray character is the Parser's problem, it may sit in a skipped group
+        int begin = pos;
+        do {
+            consume();
+        } while ((unsigned char) cur() >= 0x80 && (unsigned char) at(begin) >= 0x80 && pos < length);
+        return makeToken(Token::Type::Unknown, begin);
     }
+    if (p == Punct::None)
+        throw std::runtime_error(std::string("unable to parse ") + cur());
+    auto t = Token(p, base + pos);
+    pos += len;
+    return t;
 }
 
-Token Lexer::string() {
-    std::string s;
-  //  s += cur();
+// decodes one escape sequence into literal
+void Lexer::escape() {
+    consume();
     char c = cur();
     consume();
-    while (cur() != c) {
-        if (cur() == '\\') {
-            consume();
-            if (cur() == '\\') {
-                s += "\\\\";
-            } else if (cur() == 'n') {
-                s += "\\n";
-            } else if (cur() == '"') {
-                s += "\\\"";
-            } else if (cur() == '\'') {
-                s += "\\\'";
+    switch (c) {
+        case 'n': literal += '\n'; return;
+        case 't': literal += '\t'; return;
+        case 'r': literal += '\r'; return;
+        case 'a': literal += '\a'; return;
+        case 'b': literal += '\b'; return;
+        case 'f': literal += '\f'; return;
+        case 'v': literal += '\v'; return;
+        case 'x': {
+            int v = 0;
+            if (!isxdigit(cur()))
+                throw std::runtime_error("\\x used with no following hex digits");
+            while (isxdigit(cur())) {
+                v = v * 16 + digitValue(cur());
+                consume();
+            }
+            literal += (char) v;
+            return;
+        }
+        default:
+            if (c >= '0' && c <= '7') {
+                int v = c - '0';
+                for (int i = 0; i < 2 && cur() >= '0' && cur() <= '7'; i++) {
+                    v = v * 8 + cur() - '0';
+                    consume();
+                }
+                literal += (char) v;
+            } else {
+                literal += c; // \\, \', \", \? and unknown escapes
             }
-        } else
-            s += cur();
-        consume();
     }
+}
+
+/* Appends the bytes of the quoted literal at pos to literal.
+ * A raw lexer gives up at the end of the line and returns false, so stray
+ * quotes in skipped groups and #error lines do not run into the next line.
+ */
+bool Lexer::quoted() {
+    char quote = cur();
     consume();
-   // s += c;
-    if(s[0] == '\'' ){
-        if(s.length()!=3)
-            throw std::runtime_error(std::string("char literal to long"));
-        return makeToken(Token::Type::Int,format("{}",(int)s[1]),line, col);
+    while (true) {
+        int run = pos;
+        while (pos < length && at(pos) != quote && at(pos) != '\\' && (at(pos) != '\n' || !raw)) {
+            pos++;
+        }
+        literal.append(source + run, pos - run);
+        if (pos < length && cur() == '\n')
+            return false;
+        if (pos >= length)
+            throw std::runtime_error("unterminated string literal");
+        if (cur() == quote)
+            break;
+        escape();
     }
+    consume();
+    return true;
+}
 
-    return makeToken(Token::Type::String, s, line, col);
+/* Adjacent string literals are gathered into one buffer and interned
+ * once, so a table split over many lines costs one token.
+ * Character constants become Int tokens spelled as in the source.
+ */
+Token Lexer::string() {
+    int begin = pos;
+    char quote = cur();
+    literal.clear();
+    if (!quoted()) {
+        pos = begin + 1;
+        return makeToken(Token::Type::Unknown, begin);
+    }
+    if (quote == '\'') {
+        if (literal.empty())
+            throw std::runtime_error("empty character constant");
+        int c = 0;
+        for (auto ch : literal) {
+            c = (c << 8) | (unsigned char) ch; // multi-character constants as gcc does
+        }
+        if (literal.size() == 1)
+            c = (char) literal[0];
+        auto t = makeToken(Token::Type::Int, begin);
+        strings->setValue(t.sym, (uint64_t) (long long) c);
+        return t;
+    }
+    while (!raw) {
+        skipspace();
+        if (pos >= length || cur() != '"')
+            break;
+        quoted();
+    }
+    return Token(Token::Type::String, strings->intern(literal), base + begin);
+}
+
+std::string kcc::escapeString(const std::string &s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = s[i];
+        switch (c) {
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            case '\r': out += "\\r"; break;
+            case '\\': out += "\\\\"; break;
+            case '"': out += "\\\""; break;
+            default:
+                if (c < 0x20 || c >= 0x7f) {
+                    // as short as the next character allows
+                    bool digit = i + 1 < s.size() && s[i + 1] >= '0' && s[i + 1] <= '7';
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), digit ? "\\%03o" : "\\%o", c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
 }
 
 std::vector<Token> &Lexer::getTokenStream() {
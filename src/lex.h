@@ -8,34 +8,200 @@
 #ifndef LEX_H_
 #define LEX_H_
 #include "kcc.h"
+#include "source.h"
+#include "intern.h"
 namespace  kcc {
 	struct Token;
 
+#define KCC_KEYWORDS(X) \
+		X(Auto, "auto") \
+		X(Break, "break") \
+		X(Case, "case") \
+		X(Char, "char") \
+		X(Const, "const") \
+		X(Continue, "continue") \
+		X(Default, "default") \
+		X(Do, "do") \
+		X(Double, "double") \
+		X(Else, "else") \
+		X(Enum, "enum") \
+		X(Extern, "extern") \
+		X(Float, "float") \
+		X(For, "for") \
+		X(Goto, "goto") \
+		X(If, "if") \
+		X(Inline, "inline") \
+		X(Int, "int") \
+		X(Long, "long") \
+		X(Register, "register") \
+		X(Restrict, "restrict") \
+		X(Return, "return") \
+		X(Short, "short") \
+		X(Signed, "signed") \
+		X(Sizeof, "sizeof") \
+		X(Static, "static") \
+		X(Struct, "struct") \
+		X(Switch, "switch") \
+		X(Typedef, "typedef") \
+		X(Union, "union") \
+		X(Unsigned, "unsigned") \
+		X(Void, "void") \
+		X(Volatile, "volatile") \
+		X(While, "while") \
+		X(Alignas, "_Alignas") \
+		X(Alignof, "_Alignof") \
+		X(Atomic, "_Atomic") \
+		X(Bool, "_Bool") \
+		X(Complex, "_Complex") \
+		X(Generic, "_Generic") \
+		X(Imaginary, "_Imaginary") \
+		X(Noreturn, "_Noreturn") \
+		X(StaticAssert, "_Static_assert") \
+		X(ThreadLocal, "_Thread_local")
+
+	enum class Keyword : unsigned char {
+		None,
+#define KCC_KEYWORD_ENUM(name, spelling) name,
+		KCC_KEYWORDS(KCC_KEYWORD_ENUM)
+#undef KCC_KEYWORD_ENUM
+	};
+
+	const char *keywordSpelling(Keyword kw);
+
+#define KCC_PUNCTUATORS(X) \
+		X(Plus, "+") \
+		X(Minus, "-") \
+		X(Star, "*") \
+		X(Slash, "/") \
+		X(Percent, "%") \
+		X(Amp, "&") \
+		X(Pipe, "|") \
+		X(Caret, "^") \
+		X(LParen, "(") \
+		X(RParen, ")") \
+		X(LBracket, "[") \
+		X(RBracket, "]") \
+		X(LBrace, "{") \
+		X(RBrace, "}") \
+		X(Comma, ",") \
+		X(Assign, "=") \
+		X(Backslash, "\\") \
+		X(Less, "<") \
+		X(Greater, ">") \
+		X(Dot, ".") \
+		X(Colon, ":") \
+		X(Question, "?") \
+		X(Tilde, "~") \
+		X(Not, "!") \
+		X(AndAnd, "&&") \
+		X(OrOr, "||") \
+		X(PlusPlus, "++") \
+		X(MinusMinus, "--") \
+		X(PlusAssign, "+=") \
+		X(MinusAssign, "-=") \
+		X(StarAssign, "*=") \
+		X(SlashAssign, "/=") \
+		X(PercentAssign, "%=") \
+		X(PipeAssign, "|=") \
+		X(AmpAssign, "&=") \
+		X(CaretAssign, "^=") \
+		X(GreaterEqual, ">=") \
+		X(LessEqual, "<=") \
+		X(NotEqual, "!=") \
+		X(Equal, "==") \
+		X(Arrow, "->") \
+		X(ShiftRight, ">>") \
+		X(ShiftLeft, "<<") \
+		X(AndAndAssign, "&&=") \
+		X(OrOrAssign, "||=") \
+		X(ShiftRightAssign, ">>=") \
+		X(ShiftLeftAssign, "<<=") \
+		X(Ellipsis, "...") \
+		X(Hash, "#") \
+		X(HashHash, "##")
+
+	enum class Punct : unsigned char {
+		None,
+#define KCC_PUNCTUATOR_ENUM(name, spelling) name,
+		KCC_PUNCTUATORS(KCC_PUNCTUATOR_ENUM)
+#undef KCC_PUNCTUATOR_ENUM
+	};
+
+	const char *punctuatorSpelling(Punct p);
+
+	// longest punctuator at s, stores its length in len
+	Punct matchPunctuator(const char *s, int &len);
+
+	// string literals hold raw bytes, this turns them back into C source
+	std::string escapeString(const std::string &s);
+
+	// 12 bytes, the spelling lives in the Interner
 	struct Token {
-		enum class Type {
-			String, Int,Float, Identifier, Keyword, Punctuator, Terminator, Nil
+		enum class Type : unsigned char {
+			String, Int,Float, Identifier, Keyword, Punctuator, Terminator, Nil,
+			Unknown, // a stray character or quote, only from a raw Lexer
+			Skipped // a conditional group the Preprocessor skipped unlexed, sym is its length
 		} type;
-		std::string tok;
-		const char *filename;
-		int line;
-		int col;
+		unsigned char code; // Keyword for keywords, Punct for punctuators, Suffix for numbers
+		unsigned char flags; // Flag, only set by a raw Lexer
+		Symbol sym;
+		uint32_t offset; // global, see SourceManager
 
-		Token(Type t, const std::string to, int l, int c);
+		static const uint32_t noOffset = ~0u;
+
+		enum Flag : unsigned char {
+			StartOfLine = 1, LeadingSpace = 2
+		};
+
+		// literal suffixes of Int and Float tokens
+		enum Suffix : unsigned char {
+			Unsigned = 1, Long = 2, LongLong = 4, FloatSuffix = 8
+		};
+
+		Token(Type t, Symbol s, uint32_t o = noOffset) : type(t), code(0), flags(0), sym(s), offset(o) {}
+
+		Token(Type t, const std::string &to, uint32_t o = noOffset);
+
+		explicit Token(Punct p, uint32_t o = noOffset);
 
 		Token() :
-				tok(""), line(0), col(0), type(Type::Nil) {
+				type(Type::Nil), code(0), flags(0), sym(0), offset(noOffset) {
 		}
+
+		Keyword keyword() const { return type == Type::Keyword ? (Keyword) code : Keyword::None; }
+
+		Punct punct() const { return type == Type::Punctuator ? (Punct) code : Punct::None; }
+
+		const std::string &str() const { return Interner::get().str(sym); }
 	};
 
 
-	class Lexer {
+	// pulls tokens one at a time, returns a Nil token once exhausted
+	class TokenSource {
+	public:
+		virtual Token get() = 0;
+
+		virtual ~TokenSource() = default;
+	};
+
+	class Lexer : public TokenSource {
 		int pos;
-		int line, col;
-		const char *filename;
-		std::string source;
+		uint32_t base; // global offset of source[0]
+		const char *source; // NUL padded, see SourceFile
+		int length;
 		std::vector<Token> tokenStream;
+		size_t served; // tokens of tokenStream already returned by get()
+		bool raw; // keeps directives and separate string literals for the Preprocessor
+		bool atLineStart;
+		std::string literal; // bytes of the string literal being lexed, reused
+		Interner *strings; // private to a worker in scanParallel()
+
+		// lexes [begin, end) of the parent's buffer
+		Lexer(const Lexer &parent, int begin, int end, Interner *strings);
 
-		char at(int idx);
+		char at(int idx) { return source[idx]; }
+
+		Token lex();
 
 		Token next();
 
@@ -47,13 +213,20 @@ namespace  kcc {
 
 		char peek2();
 
-		void skipspace();
+		// true if a line ended in what was skipped, newlines inside comments do not count
+		bool skipspace();
+
+		bool crossesNewline(int begin, int end);
 
-		void skipcomment();
+		void skipwhitespace();
+
+		void skiplinecomment();
+
+		void skipblockcomment();
 
 		int isComment();
 
-		bool isKeyWord(const std::string &s);
+		static Keyword matchKeyword(const char *s, int len);
 
 		Token identifier();
 
@@ -62,18 +235,59 @@ namespace  kcc {
 		Token punctuator();
 
 		Token string();
-		template<typename... Args>
-        Token  makeToken(Args... args){
-            auto t = Token(args...);
-            t.filename = filename;
-            return t;
-        }
+
+		bool quoted();
+
+		void escape();
+
+		Token makeToken(Token::Type type, int begin) {
+			return Token(type, strings->intern(source + begin, pos - begin), base + begin);
+		}
+
+		Token makeToken(Token::Type type, const std::string &s, int begin) {
+			if (s.empty()) {
+				throw std::runtime_error("token is empty");
+			}
+			return Token(type, strings->intern(s), base + begin);
+		}
 	public:
-		Lexer(const char *filename,const std::string &s);
+		/* A raw lexer lexes '#' as a punctuator, does not join adjacent string
+		 * literals and sets the Token::Flag bits, as the Preprocessor needs.
+		 */
+		explicit Lexer(const SourceFile &file, bool raw = false);
 
+		// lexes the global offsets [begin, end) of file, begin is a line start
+		Lexer(const SourceFile &file, uint32_t begin, uint32_t end, bool raw);
+
+		// lexes the whole file into the token stream, get() then replays it
 		void scan();
 
+		/* Same result as scan(), but the file is split at line starts outside
+		 * comments and literals and the pieces are lexed on separate threads.
+		 * Small files are lexed on the calling thread.
+		 */
+		void scanParallel(int threads);
+
+		Token get() override;
+
 		std::vector<Token> &getTokenStream();
+
+		// global offset of the next character, for a lexer that has not scanned
+		uint32_t offset() const { return base + pos; }
+
+		// goes back to a token already returned that starts a line
+		void seek(uint32_t offset) {
+			pos = (int) (offset - base);
+			atLineStart = true;
+		}
+
+		/* Skips a conditional group of a raw lexer without making tokens:
+		 * looks for line-leading #if, #ifdef, #ifndef and #endif to track
+		 * nesting and stops at the #elif, #else or #endif that ends the
+		 * group, which get() returns next. Comments and literals are
+		 * respected. Returns false if the input ends first.
+		 */
+		bool skipGroup();
 	};
 }
 #endif /* LEX_H_ */
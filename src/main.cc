@@ -1,7 +1,49 @@
 #include <iostream>
 #include "compile.h"
-int main() {
+int main(int argc, char **argv) {
     kcc::Compiler compiler;
-    compiler.compileFile("..\\test.c");
-    return 0;
+    std::vector<const char *> inputs; // compiled in turn, sharing the HeaderCache
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-no-stream") {
+            compiler.streamTokens = false;
+        } else if (arg == "-lex-threads" && i + 1 < argc) {
+            compiler.lexThreads = atoi(argv[++i]);
+        } else if (arg == "-emit-pch" && i + 1 < argc) {
+            compiler.emitPCH = argv[++i];
+        } else if (arg == "-include-pch" && i + 1 < argc) {
+            compiler.includePCH = argv[++i];
+        } else if (arg == "-MD") {
+            compiler.writeDependencies = true;
+        } else if (arg == "-MF" && i + 1 < argc) {
+            compiler.dependencyFile = argv[++i];
+        } else if (arg == "-MT" && i + 1 < argc) {
+            compiler.dependencyTarget = argv[++i];
+        } else if (arg == "-defer-bodies") {
+            compiler.deferBodies = true;
+        } else if (arg == "-dump-ast") {
+            compiler.dumpAST = true;
+        } else if (arg == "-dump-ir") {
+            compiler.dumpIR = true;
+        } else if (arg == "-E") {
+            compiler.preprocessOnly = true;
+        } else if (arg.compare(0, 2, "-I") == 0) {
+            compiler.includePaths.push_back(arg.size() > 2 ? arg.substr(2) : (i + 1 < argc ? argv[++i] : ""));
+        } else if (arg.compare(0, 2, "-D") == 0) {
+            auto def = arg.size() > 2 ? arg.substr(2) : (i + 1 < argc ? std::string(argv[++i]) : "");
+            auto eq = def.find('=');
+            if (eq == std::string::npos)
+                compiler.defines.emplace_back(def, "1");
+            else
+                compiler.defines.emplace_back(def.substr(0, eq), def.substr(eq + 1));
+        } else {
+            inputs.push_back(argv[i]);
+        }
+    }
+    if (inputs.empty())
+        inputs.push_back("..\\test.c");
+    bool ok = true;
+    for (auto input : inputs)
+        ok = compiler.compileFile(input) && ok;
+    return ok ? 0 : 1;
 }
\ No newline at end of file
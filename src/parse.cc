@@ -8,111 +8,121 @@
 
 #include "parse.h"
 using namespace kcc;
-Parser::Parser(Lexer &lex) {
+
+/* Binding powers of the binary operators: an operator is taken while its
+ * left power is at least the level parseExpr() was called with, and its
+ * right operand is parsed at its right power, one above its precedence
+ * for left associative operators. '?' only starts parseTernary().
+ */
+struct BindingPower {
+    signed char left, right; // -1 for tokens that are not binary operators
+};
+
+static constexpr BindingPower bindingPower(Punct p) {
+    switch (p) {
+        case Punct::Assign:
+        case Punct::PlusAssign:
+        case Punct::MinusAssign:
+        case Punct::StarAssign:
+        case Punct::SlashAssign:
+        case Punct::ShiftRightAssign:
+        case Punct::ShiftLeftAssign:
+        case Punct::PercentAssign:
+        case Punct::PipeAssign:
+        case Punct::AmpAssign:
+        case Punct::CaretAssign:
+        case Punct::AndAndAssign:
+        case Punct::OrOrAssign:
+            return {0, 0};
+        case Punct::Question:
+            return {1, 1};
+        case Punct::OrOr:
+            return {2, 3};
+        case Punct::AndAnd:
+            return {3, 4};
+        case Punct::Pipe:
+            return {4, 5};
+        case Punct::Caret:
+        case Punct::Amp:
+            return {5, 6};
+        case Punct::Equal:
+        case Punct::NotEqual:
+            return {6, 7};
+        case Punct::GreaterEqual:
+        case Punct::LessEqual:
+        case Punct::Greater:
+        case Punct::Less:
+            return {7, 8};
+        case Punct::ShiftRight:
+        case Punct::ShiftLeft:
+            return {8, 9};
+        case Punct::Plus:
+        case Punct::Minus:
+            return {9, 10};
+        case Punct::Star:
+        case Punct::Slash:
+        case Punct::Percent:
+            return {10, 11};
+        case Punct::Dot:
+        case Punct::Arrow:
+            return {11, 12};
+        default:
+            return {-1, -1};
+    }
+}
+
+// indexed by Punct, Punct::None for tokens that are not punctuators
+static constexpr BindingPower binaryOperators[] = {
+        bindingPower(Punct::None),
+#define KCC_BINDING_POWER(name, spelling) bindingPower(Punct::name),
+        KCC_PUNCTUATORS(KCC_BINDING_POWER)
+#undef KCC_BINDING_POWER
+};
+
+Parser::Parser(TokenSource &_source) {
+    source = &_source;
+    tokens = nullptr;
+    init();
+}
+
+Parser::Parser(std::vector<Token> &stream) {
+    source = nullptr;
+    tokens = terminate(stream);
+    init();
+}
+
+const Token *Parser::terminate(std::vector<Token> &stream) {
+    size_t sentinels = 0;
+    while (sentinels < stream.size() && stream[stream.size() - 1 - sentinels].type == Token::Type::Nil)
+        sentinels++;
+    for (; sentinels < lookahead; sentinels++)
+        stream.emplace_back();
+    return stream.data();
+}
+
+void Parser::init() {
     pos = -1;
-    tokenStream = lex.getTokenStream();
-    int prec = 0;
-    /*
-     *   opPrec[","] = prec;
-     * prec++;*/
-    opPrec["="] = prec;
-    opPrec["+="] = prec;
-    opPrec["-="] = prec;
-    opPrec["*="] = prec;
-    opPrec["/="] = prec;
-    opPrec[">>="] = prec;
-    opPrec["<<="] = prec;
-    opPrec["%="] = prec;
-    opPrec["|="] = prec;
-    opPrec["&="] = prec;
-    opPrec["^="] = prec;
-    opPrec["&&="] = prec;
-    opPrec["||="] = prec;
-    prec++;
-    opPrec["?"] = ternaryPrec = prec;
-    prec++;
-    opPrec["||"] = prec;
-    prec++;
-    opPrec["&&"] = prec;
-    prec++;
-    opPrec["|"] = prec;
-    prec++;
-    opPrec["^"] = prec;
-    opPrec["&"] = prec;
-    prec++;
-    opPrec["=="] = prec;
-    opPrec["!="] = prec;
-    prec++;
-    opPrec[">="] = prec;
-    opPrec["<="] = prec;
-    opPrec[">"] = prec;
-    opPrec["<"] = prec;
-
-    prec++;
-    opPrec[">>"] = prec;
-    opPrec["<<"] = prec;
-    prec++;
-    opPrec["+"] = prec;
-    opPrec["-"] = prec;
-    prec++;
-    opPrec["*"] = prec;
-    opPrec["/"] = prec;
-    opPrec["%"] = prec;
-    prec++;
-    opPrec["."] = prec;
-    opPrec["->"] = prec;
-    opAssoc = {
-            {"+=",  0},
-            {"-=",  0},
-            {"*=",  0},
-            {"/=",  0},
-            {">>=", 0},
-            {"<<=", 0},
-            {"%=",  0},
-            {"&=",  0},
-            {"|=",  0},
-            {":=",  0},
-            {"::=", 0},
-            {"=",   0},
-            {".",   1},
-            {"->",  1},
-            {"+",   1},
-            {"-",   1},
-            {"*",   1},
-            {"/",   1},
-            {"!=",  1},
-            {"==",  1},
-            {">",   1},
-            {">=",  1},
-            {"<=",  1},
-            {"<",   1},
-            {"%",   1},
-            {"&&",  1},
-            {"&",   1},
-            {"||",  1},
-            {"|",   1}
-    };
-    types = {
-            "int",
-            "void",
-            "float",
-            "double",
-            "char",
-            "long",
-    };
-}
-
-const Token &Parser::at(int idx) const {
+    filled = 0;
+    deferBodies = false;
+    errors = 0;
+}
+
+const Token &Parser::at(int idx) {
     static Token nil = Token();
-    if (idx >= this->tokenStream.size() || idx < 0) {
+    if (idx < 0)
         return nil;
-    } else {
-        return tokenStream[idx];
+    if (!source)
+        return tokens[idx]; // the parser stops at the first Nil, well before the last
+    while (filled <= idx) {
+        window[filled & (lookahead - 1)] = source->get();
+        filled++;
     }
+    assert(idx > filled - lookahead);
+    return window[idx & (lookahead - 1)];
 }
 
 AST *Parser::parse() {
-    auto root = new TopLevel();
+    auto root = newNode<TopLevel>();
     try {
         while (hasNext()) {
             root->add(parseGlobalDefs());
@@ -125,42 +135,41 @@ AST *Parser::parse() {
 
 AST *Parser::parseExpr(int lev) {
     AST *result = parseCastExpr();
-    while (hasNext()) {
+    while (true) {
         auto next = peek();
-        if (opPrec.find(next.tok) == opPrec.end())
-            break;
-        if (opPrec[next.tok] >= lev) {
-            if (next.tok == "?") {
-                result = parseTernary(result);
-            } else {
-                consume();
-                AST *rhs = parseExpr(opAssoc[next.tok] + opPrec[next.tok]);
-                BinaryExpression *op = makeNode<BinaryExpression>(next);
-                op->add(result);
-                op->add(rhs);
-                result = hackExpr(op);
-            }
-        } else
+        auto &op = binaryOperators[(int) next.punct()];
+        if (op.left < lev) // also stops at anything that is not an operator
             break;
+        if (next.punct() == Punct::Question) {
+            result = parseTernary(result);
+        } else {
+            consume();
+            AST *rhs = parseExpr(op.right);
+            BinaryExpression *bin = makeNode<BinaryExpression>(next);
+            bin->add(result);
+            bin->add(rhs);
+            result = hackExpr(bin);
+        }
     }
     return result;
 }
 
 AST *Parser::parseUnary() {
-    if (has("+") || has("-") || has("++") || has("--")
-        || has("*")
-        || has("&")
-        || has("!")) {
+    auto p = peek().punct();
+    if (p == Punct::Plus || p == Punct::Minus || p == Punct::PlusPlus || p == Punct::MinusMinus
+        || p == Punct::Star
+        || p == Punct::Amp
+        || p == Punct::Not) {
         consume();
         auto expr = makeNode<UnaryExpression>(cur());
         expr->add(parseCastExpr());
         return expr;
-    } else if (has("sizeof")) {
+    } else if (has(Keyword::Sizeof)) {
         consume();
         auto expr = makeNode<UnaryExpression>(cur());
-        expect("(");
+        expect(Punct::LParen);
         expr->add(parseTypeName());
-        expect(")");
+        expect(Punct::RParen);
         return expr;
     }
     return parsePostfix();
@@ -168,25 +177,20 @@ AST *Parser::parseUnary() {
 
 AST *Parser::parsePostfix() {
     auto postfix = parsePrimary();
-    static std::set<std::string> postfixOperator = {
-            "++", "--", "(", "[",//".","->"
-    };
-    while (hasNext() && postfixOperator.find(peek().tok) != postfixOperator.end()) {
-        if (has("[")) {
+    while (has(Punct::PlusPlus) || has(Punct::MinusMinus) || has(Punct::LParen) || has(Punct::LBracket)) {
+        if (has(Punct::LBracket)) {
             consume();/*
-            auto index = new IndexExpression();
+            auto index = newNode<IndexExpression>();
             index->add(postfix);
             index->add(parseExpr(0));*/
-            auto add = makeNode<BinaryExpression>(Token(Token::Type::Punctuator,
-                                                        "+", -1, -1));
+            auto add = makeNode<BinaryExpression>(Token(Punct::Plus));
             add->add(postfix);
             add->add(parseExpr(0));
-            auto index = makeNode<UnaryExpression>(Token(Token::Type::Punctuator,
-                                                         "*", -1, -1));
+            auto index = makeNode<UnaryExpression>(Token(Punct::Star));
             index->add(add);
             postfix = index;
-            expect("]");
-        } else if (has("(")) {
+            expect(Punct::RBracket);
+        } else if (has(Punct::LParen)) {
             auto arg = parseArgumentExpressionList();
             auto call = makeNode<CallExpression>();
             call->add(postfix);
@@ -213,10 +217,10 @@ AST *Parser::parsePrimary() {
     } else if (next.type == Token::Type::String) {
         consume();
         return makeNode<Literal>(cur());
-    } else if (has("(")) {
+    } else if (has(Punct::LParen)) {
         consume();
         auto expr = parseExpr(0);
-        expect(")");
+        expect(Punct::RParen);
         return expr;
     } else {
         return nullptr;
@@ -224,17 +228,17 @@ AST *Parser::parsePrimary() {
 }
 
 AST *Parser::parseTernary(AST *cond) {
-    expect("?");
+    expect(Punct::Question);
     AST *ternary = makeNode<TernaryExpression>();
     ternary->add(cond);
     ternary->add(parseExpr(0));
-    expect(":");
+    expect(Punct::Colon);
     ternary->add(parseExpr(0));
     return ternary;
 }
 
 AST *Parser::parseCastExpr() {
-    if (has("(") && types.find(at(pos + 2).tok) != types.end()) {  //( kind ) cast_expr
+    if (has(Punct::LParen) && isTypeKeyword(at(pos + 2))) {  //( kind ) cast_expr
         consume();
         auto cast = makeNode<CastExpression>();
         auto type = parseTypeSpecifier();
@@ -243,7 +247,7 @@ AST *Parser::parseCastExpr() {
         type = declStack.back();
         declStack.pop_back();
         cast->add(type);
-        expect(")");
+        expect(Punct::RParen);
         cast->add(parseCastExpr());
         return cast;
     } else
@@ -251,26 +255,26 @@ AST *Parser::parseCastExpr() {
 }
 
 AST *Parser::parseArgumentExpressionList() {
-    expect("(");
+    expect(Punct::LParen);
     auto arg = makeNode<ArgumentExepressionList>();
-    while (hasNext() && !has(")")) {
+    while (hasNext() && !has(Punct::RParen)) {
         arg->add(parseExpr(0));
-        if (has(")"))
+        if (has(Punct::RParen))
             break;
-        expect(",");
+        expect(Punct::Comma);
     }
-    expect(")");
+    expect(Punct::RParen);
     return arg;
 }
 
 AST *Parser::parseBlock() {
-    if (has("{")) {
+    if (has(Punct::LBrace)) {
         consume();
         auto block = makeNode<Block>();
-        while (hasNext() && !has("}")) {
+        while (hasNext() && !has(Punct::RBrace)) {
             block->add(parseStmt());
         }
-        expect("}");
+        expect(Punct::RBrace);
         return block;
     } else {
         return parseStmt();
@@ -279,12 +283,12 @@ AST *Parser::parseBlock() {
 
 AST *Parser::parseIf() {
     auto stmt = makeNode<If>();
-    expect("if");
-    expect("(");
+    expect(Keyword::If);
+    expect(Punct::LParen);
     stmt->add(parseExpr(0));
-    expect(")");
+    expect(Punct::RParen);
     stmt->add(parseBlock());
-    if (has("else")) {
+    if (has(Keyword::Else)) {
         consume();
         stmt->add(parseBlock());
     }
@@ -293,24 +297,24 @@ AST *Parser::parseIf() {
 
 AST *Parser::parseWhile() {
     auto w = makeNode<While>();
-    expect("while");
-    expect("(");
+    expect(Keyword::While);
+    expect(Punct::LParen);
     w->add(parseExpr(0));
-    expect(")");
+    expect(Punct::RParen);
     w->add(parseBlock());
     return w;
 }
 
-#define IS_TYPE_SPECIFIER (types.find(peek().tok) != types.end())
+#define IS_TYPE_SPECIFIER (isTypeKeyword(peek()))
 
 AST *Parser::parseStmt() {
-    if (has("if"))
+    if (has(Keyword::If))
         return parseIf();
-    else if (has("while")) {
+    else if (has(Keyword::While)) {
         return parseWhile();
-    } else if (has("for")) {
+    } else if (has(Keyword::For)) {
         return parseFor();
-    } else if (has("return")) {
+    } else if (has(Keyword::Return)) {
         return parseReturn();
     } else if (IS_TYPE_SPECIFIER) {
         auto e = parseDecl();
@@ -325,12 +329,14 @@ AST *Parser::parseStmt() {
 
 
 void Parser::expect(const std::string &token) {
-    if (peek().tok != token) {
+    if (peek().str() != token) {
         auto msg = format(
-                "'{}' expected but found '{}'", token, peek().tok
+                "'{}' expected but found '{}'", token, peek().str()
         );
+        errors++;
         if (config[quitIfError]) {
-            throw ParserException(msg, cur().line, cur().col);
+            auto p = SourceManager::get().getPos(cur().offset);
+            throw ParserException(msg, p.line, p.col);
         } else {
             println("{}", msg);
         }
@@ -340,7 +346,31 @@ void Parser::expect(const std::string &token) {
 }
 
 bool Parser::has(const std::string &token) {
-    return peek().tok == token;
+    return peek().str() == token;
+}
+
+void Parser::expect(Keyword kw) {
+    if (!has(kw)) {
+        expect(keywordSpelling(kw));
+    } else {
+        consume();
+    }
+}
+
+bool Parser::has(Keyword kw) {
+    return peek().keyword() == kw;
+}
+
+void Parser::expect(Punct p) {
+    if (!has(p)) {
+        expect(punctuatorSpelling(p));
+    } else {
+        consume();
+    }
+}
+
+bool Parser::has(Punct p) {
+    return peek().punct() == p;
 }
 
 AST *Parser::parseFuncDef() {
@@ -354,20 +384,20 @@ AST *Parser::parseFuncDef() {
 }
 
 AST *Parser::parseFuncDefArg() {
-    expect("(");
+    expect(Punct::LParen);
     auto arg = makeNode<FuncDefArg>();
-    while (hasNext() && !has(")")) {
+    while (hasNext() && !has(Punct::RParen)) {
         arg->add(parseParameterType()->first());
-        if (has(")"))
+        if (has(Punct::RParen))
             break;
-        expect(",");
+        expect(Punct::Comma);
     }
-    expect(")");
+    expect(Punct::RParen);
     return arg;
 }
 
 AST *Parser::parseReturn() {
-    expect("return");
+    expect(Keyword::Return);
     if (has(";")) {
         consume();
         return makeNode<Return>();
@@ -398,11 +428,16 @@ AST *Parser::parseTypeSpecifier() {
 }
 
 AST *Parser::parseGlobalDefs() {
-    if (has("enum")) {
+    if (has(Keyword::Enum)) {
         return parseEnum();
     } else {
-        auto result = parseDecl();
-        if (result->kind() != FuncDef().kind()) {
+        bool internal = false;
+        while (has(Keyword::Static) || has(Keyword::Inline)) {
+            consume();
+            internal = true;
+        }
+        auto result = parseDecl(internal);
+        if (!isa<FuncDef>(result)) {
             expect(";");
         }
         return result;
@@ -410,22 +445,26 @@ AST *Parser::parseGlobalDefs() {
 
 }
 
-AST *Parser::parseDecl() {
+AST *Parser::parseDecl(bool internal) {
     auto type = parseTypeSpecifier();
     declStack.emplace_back(type);
     auto decl = makeNode<DeclarationList>();
     decl->add(parseDeclarationSpecifier());
-    while (has(",")) {
+    while (has(Punct::Comma)) {
         consume();
         decl->add(parseDeclarationSpecifier());
     }
     declStack.pop_back();
-    if (has("{")) {
+    if (has(Punct::LBrace)) {
         if (decl->size() != 1) {
             error(format("{}", "unexpected '{'"));
         } else {
-            auto func = convertFuncTypetoFuncDef(decl->first());
-            func->add(parseBlock());
+            auto func = (FuncDef *) convertFuncTypetoFuncDef(decl->first());
+            func->internal = internal;
+            if (internal && deferBodies)
+                skipBody(func);
+            else
+                func->add(parseBlock());
             return func;
         }
     }
@@ -433,10 +472,57 @@ AST *Parser::parseDecl() {
     return decl;
 }
 
+void Parser::skipBody(FuncDef *func) {
+    auto &body = skipped;
+    body.clear();
+    int depth = 0;
+    do {
+        auto &t = peek();
+        if (t.type == Token::Type::Nil) {
+            // the body may never be parsed, so the missing '}' is reported here
+            expect(Punct::RBrace);
+            break;
+        }
+        if (t.punct() == Punct::LBrace)
+            depth++;
+        else if (t.punct() == Punct::RBrace)
+            depth--;
+        body.push_back(t);
+        consume();
+    } while (depth > 0);
+    terminate(body);
+    auto copy = (Token *) Arena::get().allocate(body.size() * sizeof(Token), alignof(Token));
+    std::copy(body.begin(), body.end(), copy);
+    func->deferredBody = copy;
+}
+
+Block *Parser::parseDeferred(FuncDef *func) {
+    auto savedSource = source;
+    auto savedTokens = tokens;
+    auto savedPos = pos;
+    source = nullptr;
+    tokens = func->deferredBody;
+    pos = -1;
+    AST *block = nullptr;
+    try {
+        block = parseBlock();
+    } catch (ParserException &e) {
+        std::cerr << e.what() << std::endl;
+    }
+    source = savedSource;
+    tokens = savedTokens;
+    pos = savedPos;
+    if (!block)
+        block = newNode<Block>();
+    func->setBody(block);
+    func->deferredBody = nullptr;
+    return (Block *) block;
+}
+
 AST *Parser::convertFuncTypetoFuncDef(AST *decl) {
     auto func = makeNode<FuncDef>();
     auto functype = decl->first();
-    if (functype->kind() != FuncType().kind()) {
+    if (!isa<FuncType>(functype)) {
         error("function expected");
     }
     func->add(functype->first());
@@ -448,7 +534,7 @@ AST *Parser::convertFuncTypetoFuncDef(AST *decl) {
 AST *Parser::parseTypeName() {
     auto type = parseTypeSpecifier();
     declStack.emplace_back(type);
-    if(has("*")){
+    if(has(Punct::Star)){
         parseAbstractDeclarator();
         auto ty = declStack.back();
         declStack.pop_back();
@@ -465,10 +551,10 @@ void Parser::parseAbstractDirectDeclarator() {
 }
 
 void Parser::parseAbstractDeclarator() {
-    if (has("*")) {
+    if (has(Punct::Star)) {
         auto p = makeNode<PointerType>();
         consume();
-        while (has("*")) {
+        while (has(Punct::Star)) {
             consume();
             auto p2 = makeNode<PointerType>();
             p2->add(p);
@@ -481,7 +567,7 @@ void Parser::parseAbstractDeclarator() {
                 ptr->add(t);
                 break;
             } else {
-                ptr = dynamic_cast<PointerType *>(ptr->first());
+                ptr = dyn_cast<PointerType>(ptr->first());
             }
         }
         declStack.emplace_back(p);
@@ -494,7 +580,7 @@ AST *Parser::parseDeclarationSpecifier() {
     auto t = declStack.back();
     declStack.pop_back();
     auto decl = extractIdentifier(t);
-    if (has("=")) {
+    if (has(Punct::Assign)) {
         consume();
         decl->add(parseExpr(0));
     }
@@ -503,8 +589,8 @@ AST *Parser::parseDeclarationSpecifier() {
 
 void Parser::parseDirectDeclarator() {
     parseDirectDeclarator_();
-    while (hasNext() && (has("(") || has("["))) {
-        if (has("["))
+    while (hasNext() && (has(Punct::LParen) || has(Punct::LBracket))) {
+        if (has(Punct::LBracket))
             parseArrayDeclarator();
         else
             parseFunctionDeclarator();
@@ -512,10 +598,10 @@ void Parser::parseDirectDeclarator() {
 }
 
 void Parser::parseDeclarator() {
-    if (has("*")) {
+    if (has(Punct::Star)) {
         auto p = makeNode<PointerType>();
         consume();
-        while (has("*")) {
+        while (has(Punct::Star)) {
             consume();
             auto p2 = makeNode<PointerType>();
             p2->add(p);
@@ -542,15 +628,14 @@ void Parser::parseDeclarator() {
 }
 
 void Parser::parseArrayDeclarator() {
-    expect("[");
+    expect(Punct::LBracket);
     ArrayType *arr;
-    if (!has("]")) {
+    if (!has(Punct::RBracket)) {
         auto size = parsePrimary();
-        if (size->kind() != "Number") {
+        if (!isa<Number>(size)) {
             error("integer expected in array declaration");
         }
-        int i;
-        sscanf(size->getToken().tok.c_str(), "%d", &i);
+        auto i = (int) ((Number *) size)->getInt();
         arr = makeNode<ArrayType>(i);
         if (i < 0) {
             error("none-negative integer expected in array declaration");
@@ -559,7 +644,7 @@ void Parser::parseArrayDeclarator() {
     } else {
         arr = makeNode<ArrayType>();
     }
-    expect("]");
+    expect(Punct::RBracket);
     auto t = declStack.back();
     declStack.pop_back();
     arr->add(t);
@@ -579,13 +664,13 @@ void Parser::parseFunctionDeclarator() {
 }
 
 void Parser::parseDirectDeclarator_() {
-    if (has("(")) {
+    if (has(Punct::LParen)) {
         consume();
         parseDeclarator();
-        expect(")");
+        expect(Punct::RParen);
     } else if (peek().type == Token::Type::Identifier) {
         auto iden = parsePrimary();
-        if (iden->kind() != "Identifier") {
+        if (!isa<Identifier>(iden)) {
             error("identifier expected in direct declarator");
         }
         declStack.emplace_back(iden);
@@ -593,6 +678,7 @@ void Parser::parseDirectDeclarator_() {
 }
 
 AST* Parser::error(const std::string &message) {
+    errors++;
     if (config[quitIfError]) {
         throw ParserException(message);
     } else {
@@ -603,14 +689,14 @@ AST* Parser::error(const std::string &message) {
 
 AST *Parser::extractIdentifier(AST *ast) {
     AST *ty = declStack.back();
-    if (ast->kind() == "Identifier") {
+    if (isa<Identifier>(ast)) {
         auto decl = makeNode<Declaration>();
         decl->add(ty);
         decl->add(ast);
         return decl;
     } else {
         AST *walker = ast;
-        while (walker->size() && (walker->first()->kind() != "Identifier")) {
+        while (walker->size() && (!isa<Identifier>(walker->first()))) {
             walker = walker->first();
         }
         auto iden = walker->first();
@@ -623,8 +709,8 @@ AST *Parser::extractIdentifier(AST *ast) {
 }
 
 AST *Parser::parseFor() {
-    expect("for");
-    expect("(");
+    expect(Keyword::For);
+    expect(Punct::LParen);
     auto result = makeNode<For>();
     //init
     if (IS_TYPE_SPECIFIER) {
@@ -648,13 +734,13 @@ AST *Parser::parseFor() {
     }
     expect(";");
     //step
-    if (has(")")) {
+    if (has(Punct::RParen)) {
         result->add(makeNode<Empty>());
     } else {
 
         result->add(parseExpr(0));
     }
-    expect(")");
+    expect(Punct::RParen);
     result->add(parseBlock());
     return result;
 }
@@ -668,15 +754,33 @@ AST *Parser::parseParameterType() {
     return decl;
 }
 
+// the operator a compound assignment applies, None for the others
+static Punct compoundOperator(Punct p) {
+    switch (p) {
+        case Punct::PlusAssign:
+            return Punct::Plus;
+        case Punct::MinusAssign:
+            return Punct::Minus;
+        case Punct::StarAssign:
+            return Punct::Star;
+        case Punct::SlashAssign:
+            return Punct::Slash;
+        case Punct::PercentAssign:
+            return Punct::Percent;
+        case Punct::ShiftLeftAssign:
+            return Punct::ShiftLeft;
+        case Punct::ShiftRightAssign:
+            return Punct::ShiftRight;
+        default:
+            return Punct::None;
+    }
+}
+
 BinaryExpression *Parser::hackExpr(BinaryExpression *e) {
-    auto op = e->getToken().tok;
-    if (op == "+=" || op == "-=" || op == "*=" || op == "/="
-        || op == "%=" || op == "<<=" || op == ">>=") {
-        auto t = e->getToken();
-        op.pop_back();
-        t.tok = op;
-        Token t2 = t;
-        t2.tok = "=";
+    auto base = compoundOperator(e->getToken().punct());
+    if (base != Punct::None) {
+        auto t = Token(base, e->getToken().offset);
+        auto t2 = Token(Punct::Assign, t.offset);
         auto e2 = makeNode<BinaryExpression>(t2);
         auto e3 = makeNode<BinaryExpression>(t);
         e3->add(e->first());
@@ -686,34 +790,31 @@ BinaryExpression *Parser::hackExpr(BinaryExpression *e) {
         return e2;
     } else {
         //const folding
-        if(e->rhs()->kind() == Number().kind() && e->lhs()->kind() == Number().kind()){
-            Token::Type ty;
-            double result;
-            double a,b;
-            if(e->rhs()->getToken().type == Token::Type::Int &&
-                    e->lhs()->getToken().type == Token::Type::Int)
-                ty = Token::Type::Int;
-            else
-                ty = Token::Type::Float;
-            a = ((Number*)e->lhs())->getFloat();
-            b = ((Number*)e->rhs())->getFloat();
-            auto op = e->tok();
-            if( op == "+"){result = a+b;}
-            else if(op == "-"){result = a-b;}
-            else if(op == "*"){result = a*b;}
-            else if(op == "/"){result = a/b;}
-            else if(op == "%"){result = a/b;}
-            else return e;
-            if(ty == Token::Type::Int){
-                return (BinaryExpression*)makeNode<Number>(
-                        Token(ty,format("{}",(int)result),e->getToken().line,
-                                e->getToken().col));
-            }else{
-                return (BinaryExpression*)makeNode<Number>(
-                        Token(ty,format("{}",result),e->getToken().line,
-                              e->getToken().col));
+        auto lhs = dyn_cast<Number>(e->lhs()), rhs = dyn_cast<Number>(e->rhs());
+        if(lhs && rhs){
+            auto op = e->getToken().punct();
+            Number *n;
+            if (!lhs->isFloatLiteral() && !rhs->isFloatLiteral()) {
+                long long a = lhs->getInt(), b = rhs->getInt(), result;
+                if (op == Punct::Plus) { result = a + b; }
+                else if (op == Punct::Minus) { result = a - b; }
+                else if (op == Punct::Star) { result = a * b; }
+                else if (op == Punct::Slash && b != 0) { result = a / b; }
+                else if (op == Punct::Percent && b != 0) { result = a % b; }
+                else return e;
+                n = makeNode<Number>(Token(Token::Type::Int, format("{}", result), e->getToken().offset));
+                n->setInt(result);
+            } else {
+                double a = lhs->getFloat(), b = rhs->getFloat(), result;
+                if (op == Punct::Plus) { result = a + b; }
+                else if (op == Punct::Minus) { result = a - b; }
+                else if (op == Punct::Star) { result = a * b; }
+                else if (op == Punct::Slash) { result = a / b; }
+                else return e;
+                n = makeNode<Number>(Token(Token::Type::Float, format("{}", result), e->getToken().offset));
+                n->setFloat(result);
             }
-
+            return (BinaryExpression*)n;
         }else
             return e;
     }
@@ -721,17 +822,17 @@ BinaryExpression *Parser::hackExpr(BinaryExpression *e) {
 }
 
 AST *Parser::parseEnum() {
-    expect("enum");
+    expect(Keyword::Enum);
     auto e = makeNode<Enum>();
-    expect("{");
-    while (hasNext() && !has("}")) {
+    expect(Punct::LBrace);
+    while (hasNext() && !has(Punct::RBrace)) {
         e->add(parseExpr(0));
-        if (has("}"))
+        if (has(Punct::RBrace))
             break;
         else
-            expect(",");
+            expect(Punct::Comma);
     }
-    expect("}");
+    expect(Punct::RBrace);
     expect(";");
     return e;
 }
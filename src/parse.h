@@ -12,22 +12,25 @@
 #include "lex.h"
 #include "ast.h"
 #include "config.h"
+#include "arena.h"
 namespace kcc {
     class Parser {
-        std::vector<Token> tokenStream;
-        std::set<std::string> types;
-        std::unordered_map<std::string, int> opPrec;
-        std::unordered_map<std::string, int> opAssoc; //1 for left 0 for right
-        std::set<std::string> typeSpecifiers;
+        TokenSource *source;
+        static const int lookahead = 8; // tokens kept around cur(), a power of 2
+        const Token *tokens; // borrowed storage without a source, ends with lookahead Nil tokens
+        Token window[lookahead];
+        int filled; // tokens pulled from source so far
+        std::vector<Token> skipped; // the body skipBody() is reading, reused
         std::vector<AST *> declStack;
         std::unordered_map<std::string, int> enums;
         int pos;
-        int ternaryPrec;
         ConfigState config;
 
+        void init();
+
         template<typename T>
         T *newNode() {
-            return new T();
+            return Arena::get().make<T>();
         }
 
         AST *parseExpr(int);
@@ -58,7 +61,8 @@ namespace kcc {
 
         AST *parseParameterType();
 
-        AST *parseDecl();
+        // internal: the declaration is static or inline, its body may be deferred
+        AST *parseDecl(bool internal = false);
 
         AST *parseEnum();
 
@@ -88,6 +92,12 @@ namespace kcc {
 
         AST *parseFuncDef();
 
+        // copies the tokens of a body, braces included, into func->deferredBody
+        void skipBody(FuncDef *func);
+
+        // pads stream with lookahead Nil tokens as a sentinel
+        static const Token *terminate(std::vector<Token> &stream);
+
         AST *parseFuncDefArg();
 
         AST *parseReturn();
@@ -98,35 +108,68 @@ namespace kcc {
 
         bool has(const std::string &token);
 
+        void expect(Keyword kw);
+
+        bool has(Keyword kw);
+
+        void expect(Punct p);
+
+        bool has(Punct p);
+
+        // keywords that start a type name, one bit per Keyword
+        static constexpr uint64_t typeKeywords =
+                1ull << (int) Keyword::Int | 1ull << (int) Keyword::Void | 1ull << (int) Keyword::Float
+                | 1ull << (int) Keyword::Double | 1ull << (int) Keyword::Char | 1ull << (int) Keyword::Long;
+
+        static bool isTypeKeyword(const Token &t) {
+            return typeKeywords >> (int) t.keyword() & 1;
+        }
+
         template<typename T, typename... Args>
         T *makeNode(Args... args) {
-            auto t = new T(args...);
-            t->pos = SourcePos(peek().filename,peek().line, peek().col);
+            auto t = Arena::get().make<T>(args...);
+            t->pos = peek().offset;
             return t;
         }
 
     public:
-        Parser(Lexer &);
+        /* Leaves the bodies of static and inline functions unparsed, their
+         * tokens wait in FuncDef::deferredBody until parseDeferred().
+         */
+        bool deferBodies;
+        int errors; // reported so far
 
-        const Token &at(int idx) const;
+        // pulls tokens from the source on demand, with bounded lookahead
+        explicit Parser(TokenSource &source);
 
-        inline const Token &cur() const {
+        /* Random access over an already lexed stream, which is borrowed and
+         * must outlive the Parser. Nil tokens are appended to it as an end
+         * sentinel, so reading ahead needs no bounds check.
+         */
+        explicit Parser(std::vector<Token> &tokens);
+
+        const Token &at(int idx);
+
+        inline const Token &cur() {
             return at(pos);
         }
 
-        inline const Token &peek() const {
+        inline const Token &peek() {
             return at(pos + 1);
         }
 
         inline void consume() { pos++; }
 
-        inline bool hasNext() const {
-            return pos + 1 < (int) tokenStream.size();
+        inline bool hasNext() {
+            return peek().type != Token::Type::Nil;
         }
 
         AST* error(const std::string &message);
 
         AST *parse();
+
+        // parses a body left by deferBodies, any time after parse()
+        Block *parseDeferred(FuncDef *func);
     };
 
     class ParserException : public std::exception {
@@ -0,0 +1,373 @@
+#include "pch.h"
+#include "arena.h"
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#endif
+
+using namespace kcc;
+
+/* Layout, all integers in host byte order:
+ *   magic
+ *   strings: count, then length and bytes of each, in Symbol order
+ *   values: count, then (symbol, 64 bit value) for every nonzero payload
+ *   macros: count, then name, function, variadic, params, body length,
+ *           and (token, parameter index) for each body token
+ *   Sema: stack frame sizes, register count, global count, then name,
+ *         VarInfo and type of each global
+ * A type is written as a tree of nodes: tag, token, the size of an array,
+ * child count and children.
+ * A token is type, code, flags, one pad byte and its symbol.
+ */
+static const char magic[8] = {'K', 'C', 'C', 'P', 'C', 'H', '1', '\n'};
+
+// the nodes a declared type is built from
+enum NodeTag : unsigned char {
+    NoNode, Primitive, Pointer, Array, Func, FuncArg, DefArg, Decl, Iden
+};
+
+template<typename T>
+static void put(std::string &out, T v) {
+    out.append((const char *) &v, sizeof(v));
+}
+
+static void putToken(std::string &out, const Token &t) {
+    put<unsigned char>(out, (unsigned char) t.type);
+    put<unsigned char>(out, t.code);
+    put<unsigned char>(out, t.flags);
+    put<unsigned char>(out, 0);
+    put<uint32_t>(out, t.sym);
+}
+
+struct kcc::PCH::Reader {
+    const char *p, *end;
+    std::vector<Symbol> symbols; // symbol in the file -> symbol in this process
+
+    template<typename T>
+    T get() {
+        if (end - p < (ptrdiff_t) sizeof(T))
+            throw std::runtime_error("precompiled header is truncated");
+        T v;
+        memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        return v;
+    }
+
+    Symbol symbol() {
+        auto s = get<uint32_t>();
+        if (s >= symbols.size())
+            throw std::runtime_error("precompiled header is corrupt");
+        return symbols[s];
+    }
+
+    Token token() {
+        Token t;
+        t.type = (Token::Type) get<unsigned char>();
+        t.code = get<unsigned char>();
+        t.flags = get<unsigned char>();
+        get<unsigned char>();
+        t.sym = symbol();
+        return t;
+    }
+};
+
+void kcc::PCH::writeType(std::string &out, AST *ty) {
+    if (!ty) {
+        put<unsigned char>(out, NoNode);
+        return;
+    }
+    NodeTag tag;
+    switch (ty->kind()) {
+        case NodeKind::PrimitiveType:
+            tag = Primitive;
+            break;
+        case NodeKind::PointerType:
+            tag = Pointer;
+            break;
+        case NodeKind::ArrayType:
+            tag = Array;
+            break;
+        case NodeKind::FuncType:
+            tag = Func;
+            break;
+        case NodeKind::FuncArgType:
+            tag = FuncArg;
+            break;
+        case NodeKind::FuncDefArg:
+            tag = DefArg;
+            break;
+        case NodeKind::Declaration:
+            tag = Decl;
+            break;
+        case NodeKind::Identifier:
+            tag = Iden;
+            break;
+        default:
+            throw std::runtime_error(format("'{}' cannot be precompiled", ty->kindName()));
+    }
+    put<unsigned char>(out, tag);
+    putToken(out, ty->getToken());
+    if (tag == Array)
+        put<int32_t>(out, ((ArrayType *) ty)->arraySize());
+    put<uint32_t>(out, (uint32_t) ty->size());
+    for (auto i : *ty)
+        writeType(out, i);
+}
+
+AST *kcc::PCH::readType(Reader &in) {
+    AST *ty;
+    auto &arena = Arena::get();
+    auto tag = in.get<unsigned char>();
+    if (tag == NoNode)
+        return nullptr;
+    auto t = in.token();
+    switch (tag) {
+        case Primitive:
+            ty = arena.make<PrimitiveType>(t);
+            break;
+        case Pointer:
+            ty = arena.make<PointerType>();
+            break;
+        case Array:
+            ty = arena.make<ArrayType>(in.get<int32_t>());
+            break;
+        case Func:
+            ty = arena.make<FuncType>();
+            break;
+        case FuncArg:
+            ty = arena.make<FuncArgType>();
+            break;
+        case DefArg:
+            ty = arena.make<FuncDefArg>();
+            break;
+        case Decl:
+            ty = arena.make<Declaration>();
+            break;
+        case Iden:
+            ty = arena.make<Identifier>(t);
+            break;
+        default:
+            throw std::runtime_error("precompiled header is corrupt");
+    }
+    ty->pos = Token::noOffset;
+    auto n = in.get<uint32_t>();
+    for (uint32_t i = 0; i < n; i++)
+        ty->add(readType(in));
+    return ty;
+}
+
+void kcc::PCH::write(const std::string &path, const Preprocessor &cpp, const Sema &sema) {
+    auto &strings = Interner::get();
+    // names of globals become symbols, so they are stored once with the other strings
+    std::vector<std::pair<Symbol, const VarInfo *>> globals;
+    for (auto &g : sema.symbolTable[0])
+        globals.emplace_back(strings.intern(g.first), &g.second);
+    std::sort(globals.begin(), globals.end(),
+              [](const std::pair<Symbol, const VarInfo *> &a, const std::pair<Symbol, const VarInfo *> &b) {
+                  return a.first < b.first;
+              });
+    std::string out(magic, sizeof(magic));
+    auto n = (uint32_t) strings.size();
+    put<uint32_t>(out, n);
+    for (Symbol s = 0; s < n; s++) {
+        auto &str = strings.str(s);
+        put<uint32_t>(out, (uint32_t) str.size());
+        out += str;
+    }
+    uint32_t values = 0;
+    for (Symbol s = 0; s < n; s++)
+        values += strings.value(s) != 0;
+    put<uint32_t>(out, values);
+    for (Symbol s = 0; s < n; s++) {
+        if (strings.value(s)) {
+            put<uint32_t>(out, s);
+            put<uint64_t>(out, strings.value(s));
+        }
+    }
+    uint32_t macros = 0;
+    for (auto &m : cpp.macros)
+        macros += m && !m->builtin;
+    put<uint32_t>(out, macros);
+    for (Symbol s = 0; s < cpp.macros.size(); s++) {
+        auto &m = cpp.macros[s];
+        if (!m || m->builtin)
+            continue;
+        put<uint32_t>(out, s);
+        put<unsigned char>(out, m->function);
+        put<unsigned char>(out, m->variadic);
+        put<int32_t>(out, m->params);
+        put<uint32_t>(out, (uint32_t) m->body.size());
+        for (size_t i = 0; i < m->body.size(); i++) {
+            putToken(out, m->body[i]);
+            put<int32_t>(out, m->param[i]);
+        }
+    }
+    put<uint32_t>(out, sema.istackFrame.bytesAllocated);
+    put<uint32_t>(out, sema.fstackFrame.bytesAllocated);
+    put<int32_t>(out, sema.tCount);
+    put<uint32_t>(out, (uint32_t) globals.size());
+    for (auto &g : globals) {
+        auto &info = *g.second;
+        put<uint32_t>(out, g.first);
+        put<int32_t>(out, info.addr.type);
+        put<int32_t>(out, info.addr.offset);
+        put<unsigned char>(out, info.isGlobal);
+        put<unsigned char>(out, info.isTypedef);
+        writeType(out, info.ty);
+    }
+    auto f = fopen(path.c_str(), "wb");
+    if (!f)
+        throw std::runtime_error(format("cannot write '{}'", path));
+    bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok)
+        throw std::runtime_error(format("cannot write '{}'", path));
+}
+
+// the bytes of a precompiled header, mapped where mmap is available and read in one go otherwise
+struct Image {
+    const char *data;
+    size_t size;
+    size_t mappedSize; // 0 if data was read into a buffer
+
+    Image() : data(nullptr), size(0), mappedSize(0) {}
+
+    Image(const Image &) = delete;
+
+    Image &operator=(const Image &) = delete;
+
+    ~Image() {
+#ifndef _WIN32
+        if (mappedSize) {
+            munmap((void *) data, mappedSize);
+            return;
+        }
+#endif
+        delete[] data;
+    }
+
+    bool load(const char *path);
+};
+
+#ifndef _WIN32
+
+bool Image::load(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    size = (size_t) st.st_size;
+    void *p = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (p != MAP_FAILED) {
+        close(fd);
+        data = (const char *) p;
+        mappedSize = size;
+        return true;
+    }
+    auto buf = new char[size];
+    data = buf;
+    size_t total = 0;
+    while (total < size) {
+        auto n = ::read(fd, buf + total, size - total);
+        if (n <= 0)
+            break;
+        total += n;
+    }
+    close(fd);
+    return total == size;
+}
+
+#else
+
+bool Image::load(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return false;
+    fseek(f, 0, SEEK_END);
+    size = (size_t) ftell(f);
+    fseek(f, 0, SEEK_SET);
+    auto buf = new char[size];
+    data = buf;
+    auto total = fread(buf, 1, size, f);
+    fclose(f);
+    return total == size;
+}
+
+#endif
+
+void kcc::PCH::read(const std::string &path, Preprocessor &cpp, Sema &sema) {
+    Image image; // released however loading ends
+    if (!image.load(path.c_str()))
+        throw std::runtime_error(format("cannot read '{}'", path));
+    auto data = image.data;
+    auto size = image.size;
+    Reader in;
+    in.p = (const char *) data;
+    in.end = in.p + size;
+    if (size < sizeof(magic) || memcmp(in.p, magic, sizeof(magic)) != 0)
+        throw std::runtime_error(format("'{}' is not a precompiled header", path));
+    in.p += sizeof(magic);
+    auto &strings = Interner::get();
+    auto n = in.get<uint32_t>();
+    in.symbols.reserve(n);
+    for (uint32_t i = 0; i < n; i++) {
+        auto len = in.get<uint32_t>();
+        if ((size_t) (in.end - in.p) < len)
+            throw std::runtime_error("precompiled header is truncated");
+        in.symbols.push_back(strings.intern(in.p, len));
+        in.p += len;
+    }
+    auto values = in.get<uint32_t>();
+    for (uint32_t i = 0; i < values; i++) {
+        auto sym = in.symbol();
+        strings.setValue(sym, in.get<uint64_t>());
+    }
+    auto macros = in.get<uint32_t>();
+    for (uint32_t i = 0; i < macros; i++) {
+        auto name = in.symbol();
+        std::unique_ptr<Macro> m(new Macro());
+        m->function = in.get<unsigned char>() != 0;
+        m->variadic = in.get<unsigned char>() != 0;
+        m->params = in.get<int32_t>();
+        if (m->params < 0 || (m->variadic && !m->params))
+            throw std::runtime_error("precompiled header is corrupt");
+        auto len = in.get<uint32_t>();
+        for (uint32_t j = 0; j < len; j++) {
+            m->body.push_back(in.token());
+            // a parameter index is used to pick an argument as it is
+            auto index = in.get<int32_t>();
+            if (index < -1 || index >= m->params)
+                throw std::runtime_error("precompiled header is corrupt");
+            m->param.push_back(index);
+        }
+        if (cpp.macros.size() <= name)
+            cpp.macros.resize(name + 1);
+        cpp.macros[name] = std::move(m);
+    }
+    sema.istackFrame.bytesAllocated = in.get<uint32_t>();
+    sema.fstackFrame.bytesAllocated = in.get<uint32_t>();
+    sema.tCount = in.get<int32_t>();
+    auto globals = in.get<uint32_t>();
+    for (uint32_t i = 0; i < globals; i++) {
+        auto name = in.symbol();
+        VarInfo info;
+        auto type = (Value::Type) in.get<int32_t>();
+        auto offset = in.get<int32_t>();
+        info.addr = Value(type, offset);
+        info.isGlobal = in.get<unsigned char>() != 0;
+        info.isTypedef = in.get<unsigned char>() != 0;
+        info.ty = (Type *) readType(in);
+        sema.symbolTable[0][strings.str(name)] = info;
+    }
+    if (in.p != in.end)
+        throw std::runtime_error("precompiled header is corrupt");
+}
@@ -0,0 +1,30 @@
+// Precompiled headers
+
+#ifndef KCC_PCH_H
+#define KCC_PCH_H
+
+#include "cpp.h"
+#include "sema.h"
+
+namespace kcc {
+    /* The state left by a prefix header: the interned strings, the macro
+     * table and the global scope of Sema. write() stores it after the header
+     * has been parsed and checked, read() maps the file and loads it into a
+     * fresh Preprocessor and Sema instead of reading the header again.
+     * Symbols are renumbered on load, tokens lose their source offsets.
+     * Errors are thrown as std::runtime_error.
+     */
+    class PCH {
+        struct Reader;
+
+        static void writeType(std::string &out, AST *ty);
+
+        static AST *readType(Reader &in);
+
+    public:
+        static void write(const std::string &path, const Preprocessor &cpp, const Sema &sema);
+
+        static void read(const std::string &path, Preprocessor &cpp, Sema &sema);
+    };
+}
+#endif //KCC_PCH_H
@@ -3,14 +3,15 @@
 //
 
 #include "sema.h"
+#include "parse.h"
 
 using namespace kcc;
 
 void kcc::Sema::visit(For *aFor) {
-    aFor->init()->accept(this);
-    aFor->cond()->accept(this);
-    aFor->step()->accept(this);
-    aFor->body()->accept(this);
+    dispatch(aFor->init());
+    dispatch(aFor->cond());
+    dispatch(aFor->step());
+    dispatch(aFor->body());
 }
 
 void kcc::Sema::visit(Identifier *identifier) {
@@ -18,42 +19,61 @@ void kcc::Sema::visit(Identifier *identifier) {
     identifier->setType(info.ty);
     identifier->setAddr(info.addr);
     identifier->setReg(alloc());
+    if (identifier->isGlobal && parser)
+        reference(identifier->tok());
 }
 
 void kcc::Sema::visit(While *aWhile) {
-    aWhile->cond()->accept(this);
-    aWhile->body()->accept(this);
+    dispatch(aWhile->cond());
+    dispatch(aWhile->body());
 }
 
 void kcc::Sema::visit(Block *block) {
     for (auto i:*block) {
-        i->accept(this);
+        dispatch(i);
     }
 
 }
 
 void kcc::Sema::visit(TopLevel *topLevel) {
     for (auto i:*topLevel) {
-        i->accept(this);
+        dispatch(i);
+    }
+    // checking a body may reference more deferred functions
+    while (!needed.empty()) {
+        auto def = needed.back();
+        needed.pop_back();
+        parser->parseDeferred(def);
+        horizon = def->pos;
+        dispatch(def);
+        horizon = ~0u;
+    }
+}
+
+void kcc::Sema::reference(const std::string &name) {
+    auto &def = references[name];
+    if (def) {
+        needed.push_back(def);
+        def = nullptr;
     }
 }
 
 void kcc::Sema::visit(If *anIf) {
-    anIf->cond()->accept(this);
-    anIf->body()->accept(this);
+    dispatch(anIf->cond());
+    dispatch(anIf->body());
     if (anIf->size() == 3)
-        anIf->elsePart()->accept(this);
+        dispatch(anIf->elsePart());
 }
 
 void kcc::Sema::visit(TernaryExpression *expression) {
-    expression->first()->accept(this);
-    expression->second()->accept(this);
-    expression->third()->accept(this);
+    dispatch(expression->first());
+    dispatch(expression->second());
+    dispatch(expression->third());
     expression->setType(expression->third()->getType());
 }
 
 void kcc::Sema::visit(Number *number) {
-    if (number->getToken().type == Token::Type::Int) {
+    if (!number->isFloatLiteral()) {
         number->setType(makePrimitiveType("int"));
         number->isFloat = false;
     } else {
@@ -64,54 +84,47 @@ void kcc::Sema::visit(Number *number) {
 }
 
 void kcc::Sema::visit(Return *aReturn) {
-    aReturn->first()->accept(this);
-}
-
-void kcc::Sema::visit(Empty *empty) {
-
-}
-
-void kcc::Sema::visit(PrimitiveType *type) {
-
-}
-
-void kcc::Sema::visit(PointerType *type) {
-
-}
-
-void kcc::Sema::visit(ArrayType *type) {
-
+    dispatch(aReturn->first());
 }
 
 void kcc::Sema::visit(ArgumentExepressionList *list) {
     for (auto i:*list) {
-        i->accept(this);
+        dispatch(i);
     }
 }
 
 void kcc::Sema::visit(FuncDefArg *arg) {
     for (auto i:*arg) {
-        i->accept(this);
+        dispatch(i);
     }
 }
 
 void kcc::Sema::visit(FuncDef *def) {
+    if (def->deferred()) {
+        addGlobalSymbol(def->name(), def->extractCallSignature(), def->pos);
+        if (!parser)
+            return;
+        auto r = references.emplace(def->name(), def);
+        if (!r.second) // referenced before its definition
+            needed.push_back(def);
+        return;
+    }
     istackFrame.reset();
     fstackFrame.reset();
     Type *ty = def->extractCallSignature();
-    addGlobalSymbol(def->name(), ty);
+    addGlobalSymbol(def->name(), ty, def->pos);
     pushScope();
-    def->arg()->accept(this);
-    def->block()->accept(this);
+    dispatch(def->arg());
+    dispatch(def->block());
     popScope();
     def->frameSize = istackFrame.bytesAllocated + fstackFrame.bytesAllocated;
 }
 
 void kcc::Sema::visit(CallExpression *expression) {
-    expression->callee()->accept(this);
-    expression->arg()->accept(this);
+    dispatch(expression->callee());
+    dispatch(expression->arg());
     auto ty = expression->callee()->getType();
-    if (ty->kind() != FuncType().kind()) {
+    if (!isa<FuncType>(ty)) {
         error(expression, "function expected but found '{}'", getTypeRepr(ty));
         expression->setType(nullptr);
         return;
@@ -150,7 +163,7 @@ void kcc::Sema::visit(CallExpression *expression) {
 }
 
 void kcc::Sema::visit(CastExpression *expression) {
-    expression->second()->accept(this);
+    dispatch(expression->second());
     auto cast = expression->second()->getType();
     if (!cast) {
         expression->setType(nullptr);
@@ -168,19 +181,15 @@ void kcc::Sema::visit(CastExpression *expression) {
 
 }
 
-void kcc::Sema::visit(IndexExpression *expression) {
-
-}
-
 void kcc::Sema::visit(Declaration *declaration) {
     auto iden = declaration->identifier();
     auto ty = declaration->type();
-    addSymbol(iden->tok(), ty);
+    addSymbol(iden->tok(), ty, false, declaration->pos);
 }
 
 void kcc::Sema::visit(DeclarationList *list) {
     for (auto i:*list) {
-        i->accept(this);
+        dispatch(i);
     }
 }
 
@@ -238,7 +247,24 @@ void Sema::binaryExpressionAutoPromote(
 
 }
 
+/* a + b + c + ... parses into a tree as deep as the chain is long, so
+ * the left operands are walked down in a loop rather than recursively.
+ * Operands are still checked left to right, each before its operator.
+ */
 void kcc::Sema::visit(BinaryExpression *expression) {
+    auto base = chain.size();
+    for (auto e = expression; e; e = dyn_cast<BinaryExpression>(e->lhs()))
+        chain.push_back(e);
+    dispatch(chain.back()->lhs());
+    for (auto i = chain.size(); i-- > base;) {
+        dispatch(chain[i]->rhs());
+        checkBinaryExpression(chain[i]);
+    }
+    chain.resize(base);
+}
+
+// types expression, its operands have been checked
+void kcc::Sema::checkBinaryExpression(BinaryExpression *expression) {
     static std::set<std::string> intOnly = {
             ">>", "<<", "%", "|", "&", "^"
     };
@@ -246,8 +272,6 @@ void kcc::Sema::visit(BinaryExpression *expression) {
             "&&", "||", "<", ">", "<=", ">=", "!=", "=="
     };
 
-    expression->lhs()->accept(this);
-    expression->rhs()->accept(this);
     auto ty1 = expression->lhs()->getType();
     auto ty2 = expression->rhs()->getType();
     if (skipCheckIfNull(expression, ty1, ty2))
@@ -302,7 +326,7 @@ void kcc::Sema::visit(BinaryExpression *expression) {
 
 void kcc::Sema::visit(UnaryExpression *expression) {
     auto op = expression->tok();
-    expression->expr()->accept(this);
+    dispatch(expression->expr());
     auto ty = expression->expr()->getType();
     if (!ty) {
         expression->setType(nullptr);
@@ -326,32 +350,20 @@ void kcc::Sema::visit(UnaryExpression *expression) {
     }
 }
 
-void kcc::Sema::pre(AST *ast) {
-
-}
-
-void kcc::Sema::visit(Enum *anEnum) {
-
-}
-
-void kcc::Sema::visit(FuncType *type) {
-
-}
-
-void kcc::Sema::visit(PostfixExpr *expr) {
-
-}
-
-void kcc::Sema::visit(FuncArgType *type) {
-
-}
-
-void kcc::Sema::addGlobalSymbol(const std::string &s, kcc::Type *ty) {
-    symbolTable[0][s] = VarInfo(ty, Value(), true);
+// a global keeps the offset it was first declared at
+void kcc::Sema::addGlobalSymbol(const std::string &s, kcc::Type *ty, uint32_t declared) {
+    auto &var = symbolTable[0][s];
+    if (var.ty)
+        declared = std::min(declared, var.declared);
+    var = VarInfo(ty, Value(), true);
+    var.declared = declared;
 }
 
 kcc::Sema::Sema() {
     tCount = 0;
+    parser = nullptr;
+    errors = 0;
+    horizon = ~0u;
     pushScope();
     addTypeSize("int", 4);
     addTypeSize("unsigned int", 4);
@@ -360,7 +372,7 @@ kcc::Sema::Sema() {
     addTypeSize("char", 4);
 }
 
-void kcc::Sema::addSymbol(const std::string &v, kcc::Type *ty, bool isTypedef) {
+void kcc::Sema::addSymbol(const std::string &v, kcc::Type *ty, bool isTypedef, uint32_t declared) {
     auto sz = getTypeSize(ty);
     VarInfo var;
     if(isFloat(ty)) {
@@ -370,7 +382,11 @@ void kcc::Sema::addSymbol(const std::string &v, kcc::Type *ty, bool isTypedef) {
         var = VarInfo(ty, Value(Value::Type::Float,istackFrame.bytesAllocated), false, isTypedef);
         istackFrame.add(sz);
     }
-    symbolTable.back()[v] = var;
+    auto &slot = symbolTable.back()[v];
+    if (symbolTable.size() == 1 && slot.ty)
+        declared = std::min(declared, slot.declared);
+    var.declared = declared;
+    slot = var;
 }
 
 void kcc::Sema::addTypeSize(const std::string &s, unsigned int sz) {
@@ -396,6 +412,8 @@ kcc::VarInfo kcc::Sema::getVarInfo(Identifier *iden) {
         auto &scope = *iter;
         auto it = scope.find(s);
         if (it != scope.end()) {
+            if (iter == symbolTable.rend() - 1 && it->second.declared > horizon)
+                break;
             if(iter == symbolTable.rend() -1){
                 iden->isGlobal = true;
             }
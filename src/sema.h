@@ -11,17 +11,20 @@
 
 #define KCC_POINTER_SIZE 8u
 namespace kcc {
+    class Parser;
 
     struct VarInfo {
         Type *ty;
         Value addr;
         bool isGlobal;
         bool isTypedef;
+        uint32_t declared; // global source offset of the first declaration of a global, see SourceManager
 
         VarInfo() {
             ty = nullptr;
             isGlobal = false;
             isTypedef = false;
+            declared = 0;
         }
 
         VarInfo(Type *_ty, const Value &_addr, bool _isGlobal, bool _isTypedef = false) {
@@ -29,6 +32,7 @@ namespace kcc {
             addr = _addr;
             isGlobal = _isGlobal;
             isTypedef = _isTypedef;
+            declared = 0;
         }
     };
 
@@ -52,7 +56,7 @@ namespace kcc {
 
     };
 
-    class Sema : public Visitor {
+    class Sema : public NodeVisitor<Sema> {
         SymbolTable symbolTable;
         int tCount;
 
@@ -66,6 +70,19 @@ namespace kcc {
 
         StackFrame istackFrame, fstackFrame;
         std::unordered_map<std::string, unsigned int> typeSize;
+        /* Globals referenced so far, mapped to nullptr, and functions whose
+         * body was deferred and has not been needed yet. A deferred body is
+         * needed once its function is referenced.
+         */
+        std::unordered_map<std::string, FuncDef *> references;
+        std::vector<FuncDef *> needed; // deferred bodies to parse and check before the end
+        /* Globals declared past this offset are not visible yet. A deferred
+         * body is checked once the whole file is read, so it is the start of
+         * its definition then and no limit otherwise.
+         */
+        uint32_t horizon;
+
+        void reference(const std::string &name);
 
         void addTypeSize(const std::string &, unsigned int);
 
@@ -76,6 +93,7 @@ namespace kcc {
         template<typename... Args>
         void error(AST *ast, const char *message, Args... args) {
             fprintln(stderr, "{}: error: {}", ast->getPos(), format(message, args...));
+            errors++;
         }
 
         template<typename... Args>
@@ -102,77 +120,68 @@ namespace kcc {
         void binaryExpressionAutoPromote(BinaryExpression *, Type *, Type *, bool intOnly = false,
                                          bool retInt = false);
 
+        void checkBinaryExpression(BinaryExpression *);
+
+        std::vector<BinaryExpression *> chain; // left operands being walked, see visit(BinaryExpression *)
+
+        friend class PCH;
+
         Value alloc() {
             // TODO: alloc according to type
             return Value::makeIReg(tCount++);
         }
 
     public:
-        Sema();
-
-        void addGlobalSymbol(const std::string &, Type *);
-
-        void addSymbol(const std::string &, Type *, bool isTypedef = false);
-
-        void visit(For *aFor) override;
+        Parser *parser; // parses deferred function bodies, nullptr if there are none
+        int errors; // reported so far
 
-        void visit(Identifier *identifier) override;
-
-        void visit(While *aWhile) override;
-
-        void visit(Block *block) override;
-
-        void visit(TopLevel *root) override;
-
-        void visit(If *anIf) override;
-
-        void visit(TernaryExpression *expression) override;
+        Sema();
 
-        void visit(Number *number) override;
+        void addGlobalSymbol(const std::string &, Type *, uint32_t declared = 0);
 
-        void visit(Return *aReturn) override;
+        void addSymbol(const std::string &, Type *, bool isTypedef = false, uint32_t declared = 0);
 
-        void visit(Empty *empty) override;
+        using NodeVisitor<Sema>::visit;
 
-        void visit(PrimitiveType *type) override;
+        void visit(For *aFor);
 
-        void visit(PointerType *type) override;
+        void visit(Identifier *identifier);
 
-        void visit(ArrayType *type) override;
+        void visit(While *aWhile);
 
-        void visit(ArgumentExepressionList *list) override;
+        void visit(Block *block);
 
-        void visit(FuncDefArg *arg) override;
+        void visit(TopLevel *root);
 
-        void visit(FuncDef *def) override;
+        void visit(If *anIf);
 
-        void visit(CallExpression *expression) override;
+        void visit(TernaryExpression *expression);
 
-        void visit(CastExpression *expression) override;
+        void visit(Number *number);
 
-        void visit(IndexExpression *expression) override;
+        void visit(Return *aReturn);
 
-        void visit(Declaration *declaration) override;
+        void visit(ArgumentExepressionList *list);
 
-        void visit(DeclarationList *list) override;
+        void visit(FuncDefArg *arg);
 
-        void visit(Literal *literal) override;
+        void visit(FuncDef *def);
 
-        void visit(BinaryExpression *expression) override;
+        void visit(CallExpression *expression);
 
-        void visit(UnaryExpression *expression) override;
+        void visit(CastExpression *expression);
 
-        void pre(AST *ast) override;
+        void visit(Declaration *declaration);
 
-        void visit(Enum *anEnum) override;
+        void visit(DeclarationList *list);
 
-        void visit(FuncType *type) override;
+        void visit(Literal *literal);
 
-        void visit(PostfixExpr *expr) override;
+        void visit(BinaryExpression *expression);
 
-        void visit(FuncArgType *type) override;
+        void visit(UnaryExpression *expression);
 
-        ~Sema() override = default;
+        ~Sema() = default;
     };
 
 }
@@ -0,0 +1,146 @@
+#include "source.h"
+#include <cstring>
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#endif
+
+using namespace kcc;
+
+static char *allocPadded(size_t length) {
+    auto buf = new char[length + SourceFile::padding];
+    memset(buf + length, 0, SourceFile::padding);
+    return buf;
+}
+
+kcc::SourceFile::SourceFile(const std::string &_filename, const std::string &content)
+        : filename(_filename), length(content.size()), mappedSize(0), base(0) {
+    auto buf = allocPadded(length);
+    memcpy(buf, content.data(), length);
+    data = buf;
+}
+
+kcc::SourceFile::~SourceFile() {
+#ifndef _WIN32
+    if (mappedSize) {
+        munmap((void *) data, mappedSize);
+        return;
+    }
+#endif
+    delete[] data;
+}
+
+#ifndef _WIN32
+
+SourceFile *kcc::SourceFile::open(const char *filename) {
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return nullptr;
+    }
+    auto length = (size_t) st.st_size;
+    auto page = (size_t) sysconf(_SC_PAGESIZE);
+    // the kernel zero-fills the rest of the last page, which doubles as our padding
+    if (length % page != 0 && page - length % page >= padding) {
+        auto mappedSize = length + page - length % page;
+        void *p = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            close(fd);
+            return new SourceFile(filename, (const char *) p, length, mappedSize);
+        }
+    }
+    auto buf = allocPadded(length);
+    size_t total = 0;
+    while (total < length) {
+        auto n = read(fd, buf + total, length - total);
+        if (n <= 0)
+            break;
+        total += n;
+    }
+    close(fd);
+    if (total != length) {
+        delete[] buf;
+        return nullptr;
+    }
+    return new SourceFile(filename, buf, length, 0);
+}
+
+#else
+
+SourceFile *kcc::SourceFile::open(const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        return nullptr;
+    fseek(f, 0, SEEK_END);
+    auto length = (size_t) ftell(f);
+    fseek(f, 0, SEEK_SET);
+    auto buf = allocPadded(length);
+    auto total = fread(buf, 1, length, f);
+    fclose(f);
+    if (total != length) {
+        delete[] buf;
+        return nullptr;
+    }
+    return new SourceFile(filename, buf, length, 0);
+}
+
+#endif
+
+SourcePos kcc::SourceFile::getPos(uint32_t local) const {
+    if (lineStarts.empty()) {
+        lineStarts.push_back(0);
+        const char *p = data, *end = data + length;
+        while ((p = (const char *) memchr(p, '\n', end - p))) {
+            p++;
+            lineStarts.push_back((uint32_t) (p - data));
+        }
+    }
+    auto iter = std::upper_bound(lineStarts.begin(), lineStarts.end(), local) - 1;
+    int col = 1;
+    for (auto i = *iter; i < local; i++) {
+        col += data[i] == '\t' ? 4 : 1;
+    }
+    return SourcePos(name(), (int) (iter - lineStarts.begin()) + 1, col);
+}
+
+kcc::SourceManager::~SourceManager() {
+    for (auto i : files) {
+        delete i;
+    }
+}
+
+SourceManager &kcc::SourceManager::get() {
+    static SourceManager manager;
+    return manager;
+}
+
+SourceFile *kcc::SourceManager::add(SourceFile *file) {
+    file->base = next;
+    // one extra offset so the end of a file does not alias the next one
+    next += (uint32_t) file->size() + 1;
+    files.push_back(file);
+    return file;
+}
+
+SourcePos kcc::SourceManager::getPos(uint32_t offset) const {
+    auto file = find(offset);
+    if (!file)
+        return SourcePos("<built-in>", -1, -1);
+    return file->getPos(offset - file->base);
+}
+
+const SourceFile *kcc::SourceManager::find(uint32_t offset) const {
+    auto iter = std::upper_bound(files.begin(), files.end(), offset,
+                                 [](uint32_t o, const SourceFile *f) { return o < f->base; });
+    if (offset == ~0u || iter == files.begin())
+        return nullptr;
+    return *(iter - 1);
+}
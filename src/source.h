@@ -0,0 +1,93 @@
+// Source buffers handed to the lexer
+
+#ifndef KCC_SOURCE_H
+#define KCC_SOURCE_H
+
+#include "kcc.h"
+
+namespace kcc {
+    struct SourcePos {
+        int line;
+        int col;
+        const char *filename;
+
+        SourcePos() = default;
+
+        SourcePos(const char *_filename, int a, int b) {
+            line = a;
+            col = b;
+            filename = _filename;
+        }
+    };
+
+    /* A read-only source buffer followed by at least SourceFile::padding
+     * NUL bytes, so the lexer can look ahead without bounds checks.
+     * The file is mapped when the tail of its last page is large enough to
+     * hold the padding, otherwise it is read in one call into a heap buffer.
+     */
+    class SourceFile {
+        std::string filename;
+        const char *data;
+        size_t length;
+        size_t mappedSize;
+        uint32_t base;
+        mutable std::vector<uint32_t> lineStarts; // built on the first lookup
+
+        SourceFile(const SourceFile &) = delete;
+
+        SourceFile &operator=(const SourceFile &) = delete;
+
+        SourceFile(const std::string &_filename, const char *_data, size_t _length, size_t _mappedSize)
+                : filename(_filename), data(_data), length(_length), mappedSize(_mappedSize), base(0) {}
+
+        friend class SourceManager;
+
+    public:
+        static const size_t padding = 64;
+
+        // returns nullptr if the file cannot be read
+        static SourceFile *open(const char *filename);
+
+        // copies an in-memory buffer, used for builtin and generated sources
+        SourceFile(const std::string &_filename, const std::string &content);
+
+        ~SourceFile();
+
+        const char *name() const { return filename.c_str(); }
+
+        const char *begin() const { return data; }
+
+        const char *end() const { return data + length; }
+
+        size_t size() const { return length; }
+
+        // global offset of the first byte, see SourceManager
+        uint32_t offset() const { return base; }
+
+        // line and column of a byte in this file, tabs count as 4 columns
+        SourcePos getPos(uint32_t local) const;
+    };
+
+    /* Places every file in one 32-bit offset space, so a token or an AST
+     * node only needs a single offset to find its file, line and column.
+     */
+    class SourceManager {
+        std::vector<SourceFile *> files; // sorted by offset
+        uint32_t next;
+    public:
+        SourceManager() : next(0) {}
+
+        ~SourceManager();
+
+        // takes ownership of the file and assigns its offset
+        SourceFile *add(SourceFile *file);
+
+        SourcePos getPos(uint32_t offset) const;
+
+        // the file holding offset, nullptr for built-in text
+        const SourceFile *find(uint32_t offset) const;
+
+        static SourceManager &get();
+    };
+}
+#endif //KCC_SOURCE_H
@@ -3,13 +3,14 @@
 //
 
 #include "type.h"
+#include "arena.h"
 
 kcc::PrimitiveType *kcc::makePrimitiveType(const std::string& s) {
-    return new PrimitiveType(Token(Token::Type::Identifier,s,-1,-1));
+    return Arena::get().make<PrimitiveType>(Token(Token::Type::Identifier,s));
 }
 
 kcc::PointerType *kcc::makePointerType(kcc::Type *t) {
-    auto p =  new PointerType();
+    auto p = Arena::get().make<PointerType>();
     p->add(t);
     return p;
 }
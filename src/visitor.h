@@ -72,5 +72,39 @@ namespace  kcc {
             }
         }
     };
+
+    /* A visitor without virtual calls: dispatch() switches on the kind
+     * stored in the node and calls Derived::visit() for its class, which
+     * the compiler can inline. Classes a pass does not handle fall through
+     * to the no-op handlers below, brought in by the pass with
+     * `using NodeVisitor<Derived>::visit;`.
+     */
+    template<typename Derived>
+    class NodeVisitor {
+    public:
+#define KCC_NODE_VISIT(name) void visit(name *) {}
+        KCC_NODE_KINDS(KCC_NODE_VISIT)
+#undef KCC_NODE_VISIT
+
+        void dispatch(AST *ast) {
+            auto self = static_cast<Derived *>(this);
+            switch (ast->kind()) {
+#define KCC_NODE_DISPATCH(name) \
+                case NodeKind::name: \
+                    self->visit(static_cast<name *>(ast)); \
+                    break;
+                KCC_NODE_KINDS(KCC_NODE_DISPATCH)
+#undef KCC_NODE_DISPATCH
+                default:
+                    break;
+            }
+        }
+
+        void visitAll(AST *a) {
+            for (auto i : *a) {
+                dispatch(i);
+            }
+        }
+    };
 }
 #endif // VISITOR_H
@@ -0,0 +1,59 @@
+#include "writer.h"
+#include "ast.h"
+#include <cfloat>
+
+void kcc::Writer::sink(const char *s, size_t n) {
+    if (!n)
+        return;
+    if (file)
+        fwrite(s, 1, n, file);
+    else
+        target->append(s, n);
+}
+
+const char *kcc::Writer::text(const char *fmt) {
+    auto p = fmt;
+    while (*p) {
+        if (p[0] == '{' && p[1] == '}')
+            break;
+        if ((p[0] == '{' || p[0] == '}') && p[1] == p[0]) {
+            write(fmt, p + 1 - fmt);
+            fmt = p += 2;
+            continue;
+        }
+        p++;
+    }
+    write(fmt, p - fmt);
+    return p;
+}
+
+kcc::Writer &kcc::Writer::write(long long v) {
+    char s[24], *p = s + sizeof(s);
+    auto u = v < 0 ? 0ull - (unsigned long long) v : (unsigned long long) v;
+    do {
+        *--p = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        *--p = '-';
+    return write(p, s + sizeof(s) - p);
+}
+
+kcc::Writer &kcc::Writer::write(double v) {
+    char s[DBL_MAX_10_EXP + 32];
+    auto n = snprintf(s, sizeof(s), "%lf", v);
+    return write(s, (size_t) n);
+}
+
+kcc::Writer &kcc::Writer::write(const Value &v) {
+    if (v.type & Value::Type::Register) {
+        return put(v.type & Value::Type::Int ? 'i' : 'f').write(v.offset);
+    } else if (v.type & Value::Type::Imm) {
+        if (v.type & Value::Type::Int)
+            return write(v.iImm);
+        return write(v.fImm);
+    } else if (v.type & Value::Type::Mem) {
+        return put(v.type & Value::Type::Int ? 'i' : 'f').put('[').write(v.offset).put(']');
+    }
+    return *this;
+}
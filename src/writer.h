@@ -0,0 +1,125 @@
+// Buffered output for dumps
+
+#ifndef KCC_WRITER_H
+#define KCC_WRITER_H
+
+#include "kcc.h"
+#include <cstring>
+
+namespace kcc {
+    struct Value;
+
+    /* The sink the dumps of the AST, the IR, the CFG and the assembly write
+     * through. Text is copied into a block and handed to a FILE or appended
+     * to a string a block at a time. Numbers are converted in place, so
+     * nothing is allocated per item written.
+     */
+    class Writer {
+        static const size_t blockSize = 1u << 16;
+        FILE *file; // nullptr when writing to a string
+        std::string *target;
+        std::unique_ptr<char[]> block;
+        char *p, *end; // the free part of block
+
+        void sink(const char *s, size_t n);
+
+        // hands the block on to make room, see flush()
+        void drain() {
+            sink(block.get(), p - block.get());
+            p = block.get();
+        }
+
+        // writes fmt up to its next {} with {{ and }} unescaped, returns where it stopped
+        const char *text(const char *fmt);
+
+    public:
+        explicit Writer(FILE *f) : file(f), target(nullptr), block(new char[blockSize]) {
+            p = block.get();
+            end = p + blockSize;
+        }
+
+        explicit Writer(std::string &s) : file(nullptr), target(&s), block(new char[blockSize]) {
+            p = block.get();
+            end = p + blockSize;
+        }
+
+        Writer(const Writer &) = delete;
+
+        Writer &operator=(const Writer &) = delete;
+
+        ~Writer() { flush(); }
+
+        // hands what has been written to the string, or to the FILE and out of its buffer
+        void flush() {
+            drain();
+            if (file)
+                fflush(file);
+        }
+
+        Writer &put(char c) {
+            if (p == end)
+                drain();
+            *p++ = c;
+            return *this;
+        }
+
+        Writer &write(const char *s, size_t n) {
+            if ((size_t) (end - p) < n) {
+                drain();
+                if (n > blockSize) {
+                    sink(s, n);
+                    return *this;
+                }
+            }
+            memcpy(p, s, n);
+            p += n;
+            return *this;
+        }
+
+        Writer &write(const char *s) { return write(s, strlen(s)); }
+
+        Writer &write(const std::string &s) { return write(s.data(), s.size()); }
+
+        Writer &write(char c) { return put(c); }
+
+        Writer &write(long long v);
+
+        Writer &write(int v) { return write((long long) v); }
+
+        Writer &write(unsigned int v) { return write((long long) v); }
+
+        Writer &write(double v);
+
+        // as Formatter<Value> spells it
+        Writer &write(const Value &v);
+
+        Writer &indent(int n) {
+            for (size_t left = 2 * (size_t) n; left;) {
+                if (p == end)
+                    drain();
+                auto k = std::min(left, (size_t) (end - p));
+                memset(p, ' ', k);
+                p += k;
+                left -= k;
+            }
+            return *this;
+        }
+
+        // each {} in fmt is replaced by the next argument and {{ and }} stand for braces, as in format()
+        Writer &print(const char *fmt) {
+            text(fmt);
+            return *this;
+        }
+
+        template<typename T, typename... Args>
+        Writer &print(const char *fmt, const T &a, const Args &... args) {
+            auto p = text(fmt);
+            if (!*p)
+                return *this;
+            write(a);
+            return print(p + 2, args...);
+        }
+    };
+}
+
+#endif //KCC_WRITER_H
@@ -9,6 +9,7 @@
 #include "kcc.h"
 #include "ir.h"
 #include "format.h"
+#include "writer.h"
 namespace kcc {
     class DirectCodeGen {
         std::vector<std::string> header, out;
@@ -35,7 +36,7 @@ namespace kcc {
     public:
         DirectCodeGen();
         void generateFunc(Function & func);
-        void printAssembly(){for(auto& i:out)println("{}",i);}
+        void printAssembly(Writer &w){for(auto& i:out)w.write(i).put('\n');}
         template<typename ...Args>
         void emit(const char * s,Args... args){
             out.emplace_back(format(s,args...));
@@ -60,20 +61,25 @@ namespace kcc {
         int addString(const std::string & s){
             if(strConst.find(s) == strConst.end()){
                 strConst.insert(std::make_pair(s,strConst.size()));
-                emitHeader("SC{}:\n.ascii \"{}\\0\"",strConst.size()-1,s);
+                emitHeader("SC{}:\n.ascii \"{}\\0\"",strConst.size()-1,escapeString(s));
             }
             return strConst[s];
         }
         void writeFile(const char * file){
-            std::ofstream f(format("{}.s",file).c_str());
-            for(auto& i:header){
-                f << i;
+            FILE *f = fopen(format("{}.s",file).c_str(), "w");
+            if(!f)
+                return;
+            {
+                Writer w(f);
+                for(auto& i:header){
+                    w.write(i);
+                }
+                for(auto& i: out){
+                    w.write(i);
+                }
+                w.put('\n');
             }
-            for(auto& i: out){
-                f << i;
-            }
-            f<<std::endl;
-            f.close();
+            fclose(f);
             system(format("gcc {}.s -o {}.exe",file,file).c_str());
         }
         void clearReg(){